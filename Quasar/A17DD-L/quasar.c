@@ -6,17 +6,29 @@
  *
  * Key features:
  * > Up to 16 mode groups, each group may have up to 16 modes
+ * > Modes are set as perceptual brightness levels
+ * > Optional smooth ramping mode: turn off and on while ramping to lock the level
  * > Acts like factory Nanjg 105D 2-group firmware (switch to first mode, wait 2s for blink and click to change modes group)
  * > Combined On+Off-time memory with wear leveling
- * > Additional blinking modes: Police Strobe and SOS
+ * > Additional blinking modes: Police Strobe, Random Strobe, SOS and Morse beacon
  * > Three memory modes: last, first and next
- * > Low voltage indication
+ * > Low voltage indication with per-unit battery ADC calibration
  * > Turbo timer
+ * > Soft-start output ramp on power-up
+ * > Reduced CPU clock on low AMC levels
+ * > Fast PWM on high FET levels to reduce coil whine
+ * > ADC powered down between battery samples
+ * > Optional usage odometer: minutes of use per mode in EEPROM (see tools/eeprom.py)
+ * > Optional lockout: perform 8 fast clicks and hold to lock or unlock, locked light stays in power-down
+ * > Optional event trace on a spare pin for debugging (see tools/trace.py)
  * > Double channel output for FET/AMC7135
  * > Battcheck: perform 16 fast clicks to display battery percentage (up to 4 blinks for 100%, 75%, 50% and < 25%)
+ *   or voltage digits (e.g. 3 blinks, pause, 8 blinks for 3.8V)
  *
  * Flash command:
  * > avrdude -p t13 -c usbasp -u -Uflash:w:quasar.hex:a -Ulfuse:w:0x75:m -Uhfuse:w:0xFD:m
+ * Calibration image (see tools/eeprom.py), write after flashing as chip erase clears EEPROM:
+ * > avrdude -p t13 -c usbasp -Ueeprom:w:calibrated.eep:i
  */
 
 #define F_CPU 4800000	// CPU: 4.8MHz  PWM: 9.4kHz
@@ -39,6 +51,7 @@
 #define byte uint8_t
 #define sbyte int8_t
 #define WDTIME 0b01000000
+#define RING_SIZE 32		// Mode ring size in EEPROM
 #define portinit() do { DDRB = (1 << fetpin) | (1 << amcpin); PORTB = 0xff - (1 << amcpin) - (1 << fetpin) - (1 << batpin) - (1 << cappin); } while (0)
 #define sleepinit() do { WDTCR = WDTIME; sei(); MCUCR = (MCUCR & ~0b00111000) | 0b00100000; } while (0) // WDT-int and Idle-Sleep
 #define SLEEP asm volatile ("SLEEP")
@@ -49,20 +62,52 @@
 #define dischargecap() do { PORTB &= ~(1 << cappin); } while (0)
 #define adcread() do { ADCSRA |= 64; while (ADCSRA & 64); } while (0)
 #define adcresult ADCH
+#define LOCKED 0x40			// Lockout flag in EEPROM clicks byte
+#define CLICKS_MASK 0x3f	// Fast clicks counter in EEPROM clicks byte
+#define RAMPING 0x20		// Ramping flag in EEPROM clicks byte in ramp mode
+#define RAMP_LEVEL 0x1f		// Ramp level in EEPROM clicks byte in ramp mode
 #define ADCoff ADCSRA &= ~(1 << 7) // ADC off (enable = 0)
 #define ACoff  ACSR |= (1 << 7)    // AC off (disable = 1)
+#define adcpowerup() do { PRR = 0; ADCSRA |= (1 << 7); } while (0)				// Power up and enable ADC
+#define adcpowerdown() do { ADCSRA &= ~(1 << 7); PRR = 1 << PRADC; } while (0)	// Disable and power down ADC
+#define powerdowninit() do { MCUCR = (MCUCR & ~0b00111000) | 0b00110000; } while (0)	// Power-down sleep, only WDT can wake up
+#define bodoff() do { BODCR = (1 << BODS) | (1 << BODSE); BODCR = 1 << BODS; } while (0)	// BOD off in next sleep: BODS within 4 cycles, SLEEP within 3
+#define fastpwm() do { TIFR0 = 1 << TOV0; while (!(TIFR0 & (1 << TOV0))); TCCR0A |= 0b00000010; } while (0)	// Switch to fastPWM at BOTTOM to avoid glitch -> F_CPU / 256 instead of F_CPU / 510
+#define clockdown() do { cli(); CLKPR = 1 << CLKPCE; CLKPR = 2; sei(); } while (0)	// CPU and PWM clk/4 (F_CPU / 4, PWM F_CPU / 2040), WDT is not affected
 
 /* Special modes. Comment out to disable */
 #define STROBE			126
 #define PSTROBE			125
 #define SOS				124
+//#define RSTROBE		123	// Random Strobe, uncomment to enable
+#define RSTROBE_ON		1, 2	// Random Strobe impulse and pause length bounds (min, max) in 1/50s
+#define RSTROBE_OFF		2, 9	// (max - min + 1) must be PowerOfTwo
+//#define BEACON		122	// Morse message beacon, uncomment to enable
+#define MORSE_UNIT		5	// Morse dot length for SOS and BEACON in 1/50s
+//#define RAMP			121	// Smooth ramping through LEVELS, uncomment to enable
+#define RAMP_STEP		3	// Ramp step time in 1/50s
+#define RAMP_RING		52	// EEPROM address of ramp level ring (outside of mode ring), level is saved there on every ramp step
+#define RAMP_RING_SIZE	8	// Ramp level ring size (PowerOfTwo), every cell is written once per this many ramp steps
 #define BATTMON			125	// Enable battery monitoring with this threshold
+#define CALIBRATION		63	// EEPROM address of battery ADC calibration byte (outside of mode ring), comment out to disable
+//#define USAGE			32	// EEPROM address of usage odometer (2 bytes per mode, owner and carry bytes, outside of mode ring), uncomment to enable
+#define USAGE_FLUSH		4	// Minutes of use per usage counter update (even), shorter use is carried over in 15s steps
+//#define TRACE			4	// Bit-banged event trace on this pin (PB3 if ONTIME_LOCK is off, see tools/trace.py), uncomment to enable
 #define BATTCHECK		16	// Amount of fast clicks to trigger BATTCHECK mode, comment out to disable
+//#define BATTCHECK_VOLTS		// Uncomment to display voltage digits instead of percentage in BATTCHECK mode
+//#define LOCKOUT		8	// Amount of fast clicks followed by hold to lock or unlock, uncomment to enable
 #define TURBO_TIMEOUT	60	// Comment out to disable, 60 ~ 60s
+#define SOFT_START		3	// Power-up ramp steps in 1/50s, output doubles every step, comment out to disable
+#define POWER_GATING		// Power down ADC between samples and disable digital inputs on analog pins, comment out to disable
+#define FAST_PWM		32	// Use fast PWM on FET levels above this value, phase-correct on others, comment out to disable
+#define LOW_CLOCK		-8	// Reduce CPU clock on AMC moon levels from this value to -1 to cut MCU current (PWM drops to audible range), comment out to disable
 
 /* Memory settings */
 #define MEM_LAST			// Memory mode: MEM_FIRST, MEM_NEXT, MEM_LAST
-#define CAP_THRESHOLD	190	// Threshold voltage on the OTC
+#define CAP_THRESHOLD	190	// Threshold voltage on the OTC, use tools/otc.py to tune for component tolerances
+//#define PREV_THRESHOLD	60	// OTC voltage from this to CAP_THRESHOLD (medium off) steps back to previous mode, uncomment to enable
+// Off-time windows with 1uF/330k OTC and 190/60 thresholds on every unit within tolerances (tools/otc.py --prev 60):
+// below 0.35s next mode, 0.56...0.70s previous mode, above 1.0s long off; times in between depend on the unit
 #define LOCKTIME 50			// Time in 1/50s until a group gets locked after blink, e.g. 50/50 = 1s
 #define ONTIME_LOCK			// Use on-time mode locking, comment out to disable
 
@@ -72,18 +117,177 @@
 #define GROUPS_COUNT		2	// 2 groups
 #define GROUP_CHANGE_MODE	0	// Mode number for group change blink
 
-/* Groups and modes definition
+/* Perceptual brightness levels, use tools/levels.py to generate
+ * Logarithmic steps above level 10, levels 1...10 are one AMC value apart (8-bit PWM has no finer low values)
  * Negative values - for AMC, positive - for FET
- * Values range: -127...+127, e.g. -127 value means 255 on AMC pin, +127 means 255 on FET
+ * Values range: -127...+127, e.g. -127 value means 255 on AMC pin, +127 means 255 on FET */
+#define LEVELS				// Use level numbers in groups, comment out to use raw PWM values instead
+#ifdef LEVELS
+	#define LEVELS_COUNT	32
+	PROGMEM const sbyte levels[LEVELS_COUNT] = { -1, -2, -3, -4, -5, -6, -7, -8, -9, -10, -13, -16, -20, -25, -31, -39, -48, -60, -75, -93, -127, 14, 17, 22, 27, 34, 42, 53, 66, 82, 102, 127 };
+#endif
+
+/* Groups and modes definition
+ * Level numbers 1...LEVELS_COUNT (or raw PWM values without LEVELS) and special mode codes
  * Zero slots at the end of group will be ignored */
-PROGMEM const sbyte groups[GROUPS_COUNT][MODES_COUNT] = {{ -3, -127, 64, 127, 0, 0, 0, 0 },
-														 { -3, -127, 64, 127, STROBE, PSTROBE, SOS, 0 }};
+PROGMEM const sbyte groups[GROUPS_COUNT][MODES_COUNT] = {{ 3, 21, 29, 32, 0, 0, 0, 0 },
+														 { 3, 21, 29, 32, STROBE, PSTROBE, SOS, 0 }};
+
+/* Morse messages, use tools/morse.py to encode text
+ * Each byte is one character 0bLLLEEEEE: L - elements count, E - elements starting from LSB (0 - dot, 1 - dash)
+ * Zero byte is a word space */
+#ifdef SOS
+	PROGMEM const byte sosMessage[] = { 0x60, 0x67, 0x60 };	// SOS
+#endif
+#ifdef BEACON
+	PROGMEM const byte beaconMessage[] = { 0x8b, 0x64, 0x42, 0x60, 0x42, 0x62 };	// QUASAR
+#endif
+
+/* Battery voltage table for BATTCHECK_VOLTS, use tools/voltage.py to generate for another divider
+ * Each value is the lowest ADC reading for (VOLTS_MIN + 1 + index) decivolts */
+#ifdef BATTCHECK_VOLTS
+	#define VOLTS_MIN	20	// Lowest voltage readout in decivolts
+	PROGMEM const byte voltageTable[] = { 83, 88, 92, 97, 102, 106, 111, 115, 120, 125, 129, 134, 138, 143, 148, 152, 157, 161, 166, 171, 175, 180, 184, 189, 194 };
+#endif
 
 														
 /* ============================================================================================================================================ */
 
 
-#ifdef BATTCHECK
+#if defined(BATTCHECK) || defined(LOCKOUT)
+	#define COUNT_CLICKS
+#endif
+/* Special mode codes must be distinct, non-zero and above level numbers (tools/build.py also checks groups and levels tables) */
+#ifdef STROBE
+	#define STROBE_CODE STROBE
+#else
+	#define STROBE_CODE -1	// Disabled, never matches
+#endif
+#ifdef PSTROBE
+	#define PSTROBE_CODE PSTROBE
+#else
+	#define PSTROBE_CODE -2	// Disabled, never matches
+#endif
+#ifdef SOS
+	#define SOS_CODE SOS
+#else
+	#define SOS_CODE -3	// Disabled, never matches
+#endif
+#ifdef RSTROBE
+	#define RSTROBE_CODE RSTROBE
+#else
+	#define RSTROBE_CODE -4	// Disabled, never matches
+#endif
+#ifdef BEACON
+	#define BEACON_CODE BEACON
+#else
+	#define BEACON_CODE -5	// Disabled, never matches
+#endif
+#ifdef RAMP
+	#define RAMP_CODE RAMP
+#else
+	#define RAMP_CODE -6	// Disabled, never matches
+#endif
+#if STROBE_CODE == PSTROBE_CODE || STROBE_CODE == SOS_CODE || STROBE_CODE == RSTROBE_CODE \
+	|| STROBE_CODE == BEACON_CODE || STROBE_CODE == RAMP_CODE || PSTROBE_CODE == SOS_CODE \
+	|| PSTROBE_CODE == RSTROBE_CODE || PSTROBE_CODE == BEACON_CODE || PSTROBE_CODE == RAMP_CODE \
+	|| SOS_CODE == RSTROBE_CODE || SOS_CODE == BEACON_CODE || SOS_CODE == RAMP_CODE \
+	|| RSTROBE_CODE == BEACON_CODE || RSTROBE_CODE == RAMP_CODE || BEACON_CODE == RAMP_CODE
+	#error "Special mode codes must be distinct"
+#endif
+#ifdef LEVELS
+	#define SPECIAL_BELOW(code) (code <= LEVELS_COUNT)
+#else
+	#define SPECIAL_BELOW(code) 0
+#endif
+#if (STROBE_CODE >= 0 && (STROBE_CODE == 0 || STROBE_CODE > 127 || SPECIAL_BELOW(STROBE_CODE))) \
+	|| (PSTROBE_CODE >= 0 && (PSTROBE_CODE == 0 || PSTROBE_CODE > 127 || SPECIAL_BELOW(PSTROBE_CODE))) \
+	|| (SOS_CODE >= 0 && (SOS_CODE == 0 || SOS_CODE > 127 || SPECIAL_BELOW(SOS_CODE))) \
+	|| (RSTROBE_CODE >= 0 && (RSTROBE_CODE == 0 || RSTROBE_CODE > 127 || SPECIAL_BELOW(RSTROBE_CODE))) \
+	|| (BEACON_CODE >= 0 && (BEACON_CODE == 0 || BEACON_CODE > 127 || SPECIAL_BELOW(BEACON_CODE))) \
+	|| (RAMP_CODE >= 0 && (RAMP_CODE == 0 || RAMP_CODE > 127 || SPECIAL_BELOW(RAMP_CODE)))
+	#error "Special mode codes must be 1...127 and above LEVELS_COUNT"
+#endif
+#if GROUP_CHANGE_MODE >= MODES_COUNT
+	#error "GROUP_CHANGE_MODE must be below MODES_COUNT"
+#endif
+#if MODES_COUNT > 16 || GROUPS_COUNT > 16
+	#error "MODES_COUNT and GROUPS_COUNT must be up to 16"
+#endif
+#if defined(RAMP) && (!defined(LEVELS) || LEVELS_COUNT > RAMP_LEVEL + 1)
+	#error "RAMP requires LEVELS with up to 32 levels"
+#endif
+#if defined(PREV_THRESHOLD) && PREV_THRESHOLD >= CAP_THRESHOLD
+	#error "PREV_THRESHOLD must be below CAP_THRESHOLD"
+#endif
+#if defined(TRACE) && (TRACE == fetpin || TRACE == amcpin || TRACE == batpin || (TRACE == cappin && defined(ONTIME_LOCK)))
+	#error "TRACE pin is used for PWM, battery monitoring or OTC"
+#endif
+#if defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+	#error "A17DD-L firmware is for ATtiny13A only, ATtiny25/45/85 are supported by Nanjg firmware"
+#endif
+#if defined(CALIBRATION) && (CALIBRATION < RING_SIZE || CALIBRATION > E2END)
+	#error "CALIBRATION byte must be between mode ring and the last EEPROM byte"
+#endif
+#ifdef USAGE
+	#define USAGE_TICK 15		// Seconds of use per carry bit
+	#define USAGE_TICKS (USAGE_FLUSH * 60 / USAGE_TICK)	// Carry bits, USAGE_FLUSH minutes
+	#define USAGE_OWNER (USAGE + MODES_COUNT * 2)	// Mode of carried time
+	#define USAGE_CARRY (USAGE_OWNER + 1)	// Carry bytes
+	#define USAGE_END (USAGE_CARRY + USAGE_TICKS / 8)
+#endif
+#if defined(USAGE) && (USAGE_FLUSH < 2 || USAGE_FLUSH > 16 || USAGE_FLUSH % 2)
+	#error "USAGE_FLUSH must be an even number of minutes up to 16"
+#endif
+#if defined(USAGE) && (USAGE < RING_SIZE || USAGE_END > E2END + 1)
+	#error "USAGE counters must fit between mode ring and the last EEPROM byte"
+#endif
+#if defined(USAGE) && defined(CALIBRATION) && CALIBRATION >= USAGE && CALIBRATION < USAGE_END
+	#error "USAGE counters must not overlap CALIBRATION byte"
+#endif
+#if defined(RAMP) && (RAMP_RING < RING_SIZE || RAMP_RING + RAMP_RING_SIZE > E2END + 1 || (RAMP_RING_SIZE & (RAMP_RING_SIZE - 1)))
+	#error "RAMP_RING must fit between mode ring and the last EEPROM byte, RAMP_RING_SIZE must be PowerOfTwo"
+#endif
+#if defined(RAMP) && ((defined(CALIBRATION) && CALIBRATION >= RAMP_RING && CALIBRATION < RAMP_RING + RAMP_RING_SIZE) \
+	|| (defined(USAGE) && USAGE < RAMP_RING + RAMP_RING_SIZE && RAMP_RING < USAGE_END))
+	#error "RAMP_RING must not overlap CALIBRATION byte or USAGE counters"
+#endif
+
+
+/* Simulation with simavr: tools/simulate.py builds an ELF with SIMAVR defined, traces are written to quasar.vcd */
+#ifdef SIMAVR
+	#include <avr/eeprom.h>
+	#include "avr_mcu_section.h"
+	AVR_MCU(F_CPU, "attiny13");
+	AVR_MCU_VCD_FILE("quasar.vcd", 1000);
+	AVR_MCU_VCD_IRQ(WDT);	// Each wake-up from sleep is a WDT interrupt
+	AVR_MCU_VCD_PORT_PIN('B', fetpin, "FET");	// Pin states as driven by Timer0 compare outputs, PINB reads do not trace them
+	AVR_MCU_VCD_PORT_PIN('B', amcpin, "AMC");
+	const struct avr_mmcu_vcd_trace_t simTraces[] _MMCU_ = {
+		{ AVR_MCU_VCD_SYMBOL("OTC"), .mask = 1 << cappin, .what = (void*)&PORTB },
+		{ AVR_MCU_VCD_SYMBOL("OCR0A"), .what = (void*)&OCR0A },
+		{ AVR_MCU_VCD_SYMBOL("OCR0B"), .what = (void*)&OCR0B },
+		{ AVR_MCU_VCD_SYMBOL("CLKPR"), .what = (void*)&CLKPR },
+		{ AVR_MCU_VCD_SYMBOL("EEPE"), .mask = 1 << EEPE, .what = (void*)&EECR },
+		{ AVR_MCU_VCD_SYMBOL("EEAR"), .what = (void*)&EEARL },
+		{ AVR_MCU_VCD_SYMBOL("EEDR"), .what = (void*)&EEDR },
+		#ifdef TRACE
+			{ AVR_MCU_VCD_SYMBOL("TRACE"), .mask = 1 << TRACE, .what = (void*)&PORTB },
+		#endif
+	};
+	#if !defined(SIM_BATTERY) && !defined(SIM_ADC)
+		#define SIM_BATTERY 180	// Battery ADC reading, simavr leaves ADC inputs at 0V unless SIM_ADC harness drives them
+	#endif
+	#ifndef SIM_CAP
+		#define SIM_CAP 0	// OTC ADC reading, above CAP_THRESHOLD simulates a short click
+	#endif
+	#ifdef SIM_MODE
+		EEMEM const byte simRecord[2] = { SIM_CLICKS, SIM_GROUP << 4 | SIM_MODE };	// Mode ring record at power-on
+	#endif
+#endif
+
+
+#ifdef COUNT_CLICKS
 	byte shortClicks = 0;
 #endif
 byte group = 0;
@@ -93,6 +297,53 @@ byte ticks = 0;
 #ifdef TURBO_TIMEOUT
 	byte turboTicks = 0;
 #endif
+#ifdef RSTROBE
+	byte lfsr = 0;
+#endif
+#ifdef LOCKOUT
+	byte lockout = 0;	// LOCKED or 0
+#endif
+#ifdef RAMP
+	byte rampData = 0;	// RAMPING flag or locked level index while in ramp mode, kept in EEPROM clicks byte
+	byte rampPos = 0;	// Current cell of ramp level ring
+#endif
+#ifdef USAGE
+	byte usageTicks = 0;	// Cleared usage carry bits, USAGE_TICK seconds each
+#endif
+#ifdef CALIBRATION
+	sbyte calibration = 0;	// Offset added to every battery ADC reading
+#endif
+
+
+/* Event trace: codes are sent MSB first on TRACE pin, each bit is 3 units long and high for 1 unit (0) or 2 units (1) */
+#ifdef TRACE
+	#include <util/delay_basic.h>
+	#define TRACE_UNIT 10		// Trace unit in 3-cycle delay loops
+	#define TRACE_BOOT 0x10		// Power-on
+	#define TRACE_MODE 0x20		// | mode, mode chosen
+	#define TRACE_COMMIT 0x30	// | eepos / 2, mode ring record written
+	#define TRACE_LVP 0x40		// Low voltage step-down
+	#define TRACE_TURBO 0x50	// Turbo timeout step-down
+	#define traceinit() do { DDRB |= 1 << TRACE; PORTB &= ~(1 << TRACE); } while (0)
+	void trace(byte code) {
+		byte sreg = SREG;
+		cli();	// Keep bit timing, WDT interrupt waits until code is sent
+		byte i = 8;
+		do {
+			PORTB |= 1 << TRACE;
+			_delay_loop_1(TRACE_UNIT);
+			if (!(code & 0x80)) PORTB &= ~(1 << TRACE);
+			_delay_loop_1(TRACE_UNIT);
+			PORTB &= ~(1 << TRACE);
+			_delay_loop_1(TRACE_UNIT);
+			code <<= 1;
+		} while (--i);
+		SREG = sreg;
+	}
+#else
+	#define traceinit()
+	#define trace(code)
+#endif
 
 
 /* WatchDogTimer interrupt */
@@ -117,10 +368,34 @@ void doSleep(byte count) {
 /* Get and return ADC value */
 byte getADCResult(void) {
 	adcread();
+	#ifdef SIM_BATTERY
+		if ((ADMUX & 0xf) == capchn) return SIM_CAP;
+		return SIM_BATTERY;
+	#endif
 	return adcresult;
 }
 
 
+/* Get and return calibrated battery voltage */
+byte getBatteryVoltage(void) {
+	#ifdef POWER_GATING
+		adcpowerup();
+		getADCResult();	// Discard first conversion while reference settles
+	#endif
+	byte voltage = getADCResult();
+	#ifdef POWER_GATING
+		adcpowerdown();
+	#endif
+	#ifdef CALIBRATION
+		byte calibrated = voltage + calibration;
+		if (calibration > 0 && calibrated < voltage) calibrated = 255;	// Saturate instead of wrapping around
+		if (calibration < 0 && calibrated > voltage) calibrated = 0;
+		voltage = calibrated;
+	#endif
+	return voltage;
+}
+
+
 /* Get next mode number */
 byte getNextMode(void) {
 	byte nextMode = mode + 1;
@@ -129,8 +404,35 @@ byte getNextMode(void) {
 }
 
 
+#ifdef PREV_THRESHOLD
+/* Get previous mode number */
+byte getPrevMode(void) {
+	byte prevMode = mode;
+	if (!prevMode) {
+		prevMode = MODES_COUNT;
+		while (!pgm_read_byte(&groups[group][prevMode - 1])) prevMode--;	// Skip empty slots at the end of group
+	}
+	return prevMode - 1;
+}
+#endif
+
+
+#ifdef RAMP
+/* Check if current mode is ramp mode */
+byte isRampMode(void) {
+	return pgm_read_byte(&groups[group][mode]) == RAMP;
+}
+#endif
+
+
 /* Write word to EEPROM with wear leveling */
 void eepSave(byte c, byte g, byte m) {
+	#ifdef LOCKOUT
+		c |= lockout;
+	#endif
+	#ifdef RAMP
+		if (pgm_read_byte(&groups[g][m]) == RAMP) c |= rampData;	// Ramp data belongs to ramp mode records only
+	#endif
 	byte oldpos = eepos;
 	eepos = (eepos + 2) & 31; // Wear leveling, use next cell
 	
@@ -145,7 +447,21 @@ void eepSave(byte c, byte g, byte m) {
 	EEARL = eepos + 1; EEDR = g << 4 | m; EECR = 32 + 4; EECR = 32 + 4 + 2; // 32:write only (no erase) 4:enable  2:go
 	while (EECR & 2); // Wait for completion
 	EEARL = oldpos + 1; EECR = 16 + 4; EECR = 16 + 4 + 2; // 16:erase only (no write) 4:enable  2:go
+	trace(TRACE_COMMIT | eepos >> 1);
+}
+
+
+#ifdef RAMP
+/* Write ramp level to next cell of level ring and erase the previous one, on every ramp step */
+void rampSave(byte level) {
+	byte oldpos = RAMP_RING + rampPos;
+	rampPos = (rampPos + 1) & (RAMP_RING_SIZE - 1); // Wear leveling, use next cell
+	while (EECR & 2); // Wait for completion
+	EEARL = RAMP_RING + rampPos; EEDR = level; EECR = 32 + 4; EECR = 32 + 4 + 2; // 32:write only (no erase) 4:enable  2:go
+	while (EECR & 2); // Wait for completion
+	EEARL = oldpos; EECR = 16 + 4; EECR = 16 + 4 + 2; // 16:erase only (no write) 4:enable  2:go
 }
+#endif
 
 
 /* Decode group from data (0bGGGG****) */
@@ -168,29 +484,150 @@ byte eepReadByte(byte addr) {
 }
 
 
+#ifdef LOCKOUT
+/* Rewrite clicks byte of current record in place while locked, group and mode stay
+ * Single operation without waiting for it, write only if no bit gets set (old: current cell value) */
+void eepSaveClicks(byte old, byte c) {
+	c |= lockout;
+	#ifdef RAMP
+		c |= rampData;	// Only set in ramp mode
+	#endif
+	byte sreg = SREG;
+	cli();	// EEPE must follow EEMPE within four cycles
+	while (EECR & 2); // Wait for completion
+	EEARL = eepos; EEDR = c;
+	if (c & ~old) {
+		EECR = 4; EECR = 4 + 2; // 0:erase and write 4:enable  2:go
+	} else {
+		EECR = 32 + 4; EECR = 32 + 4 + 2; // 32:write only (no erase) 4:enable  2:go
+	}
+	SREG = sreg;
+}
+#endif
+
+
+#ifdef USAGE
+/* Write byte to EEPROM (erase and write) */
+void eepWriteByte(byte addr, byte data) {
+	while (EECR & 2); // Wait for completion
+	EEARL = addr; EEDR = data; EECR = 4; EECR = 4 + 2; // 0:erase and write 4:enable  2:go
+}
+
+
+/* Add minutes to usage counter of mode m
+ * Counters are 16-bit little-endian and stored inverted, so erased cells mean zero.
+ * High byte is written only on carry, low byte at most 65535 / USAGE_FLUSH times */
+void addUsage(byte m, byte minutes) {
+	byte addr = USAGE + (m << 1);
+	while (EECR & 2); // Wait for completion
+	byte high = eepReadByte(addr + 1);
+	uint16_t counter = ~(eepReadByte(addr) | (high << 8));
+	if (counter <= 0xffff - minutes) {
+		counter = ~(counter + minutes);
+		eepWriteByte(addr, counter);
+		if ((counter >> 8) != high) eepWriteByte(addr + 1, counter >> 8);
+	}
+}
+
+
+/* Erase carry bytes */
+void clearUsageCarry(void) {
+	for (byte addr = USAGE_CARRY; addr < USAGE_END; addr++) {
+		while (EECR & 2); // Wait for completion
+		EEARL = addr; EECR = 16 + 4; EECR = 16 + 4 + 2; // 16:erase only (no write) 4:enable  2:go
+	}
+	usageTicks = 0;
+}
+
+
+/* Count carry bits cleared in earlier sessions */
+void usageInit(void) {
+	cli();	// Disable interrupts
+	while (EECR & 2); // Wait for completion
+	for (byte addr = USAGE_CARRY; addr < USAGE_END; addr++) {
+		for (byte bits = eepReadByte(addr); bits != 0xff; bits = bits >> 1 | 0x80) usageTicks++;
+	}
+	sei();	// Enable interrupts
+}
+
+
+/* Add USAGE_TICK seconds of use of current mode
+ * Carry bits are cleared one at a time without erase and kept across sessions of the same mode.
+ * A full carry adds USAGE_FLUSH minutes to the counter, carry of another mode goes to its counter rounded to minutes */
+void addUsageTick(void) {
+	cli();	// Disable interrupts
+	while (EECR & 2); // Wait for completion
+	byte owner = eepReadByte(USAGE_OWNER);
+	if (owner != mode) {
+		if (usageTicks) {
+			if (owner < MODES_COUNT) addUsage(owner, (usageTicks + 60 / USAGE_TICK / 2) / (60 / USAGE_TICK));
+			clearUsageCarry();
+		}
+		eepWriteByte(USAGE_OWNER, mode);
+	}
+	while (EECR & 2); // Wait for completion
+	EEARL = USAGE_CARRY + (usageTicks >> 3); EEDR = 0xfe << (usageTicks & 7); EECR = 32 + 4; EECR = 32 + 4 + 2; // 32:write only (no erase) 4:enable  2:go
+	if (++usageTicks >= USAGE_TICKS) {
+		addUsage(mode, USAGE_FLUSH);
+		clearUsageCarry();
+	}
+	sei();	// Enable interrupts
+}
+#endif
+
+
 /* Load data from EEPROM and write next mode */
 inline void eepLoad(void) {
 	byte clicksData;
-	while (EECR & 2);
+	while (EECR & 2) {}	// Wait for pending write
+	#ifdef CALIBRATION
+		calibration = ~eepReadByte(CALIBRATION);	// Stored inverted, so erased cell (0xff) means no offset
+	#endif
 	while (((clicksData = eepReadByte(eepos)) == 0xff) && (eepos < 30)) eepos++;	// Find first data byte
 	byte groupMode = eepReadByte(eepos + 1);	// Read second data byte
+	#ifdef RAMP
+		byte rampLevel;
+		while (((rampLevel = eepReadByte(RAMP_RING + rampPos)) == 0xff) && (rampPos < RAMP_RING_SIZE - 1)) rampPos++;	// Find ramp level cell
+	#endif
 	
 	if (clicksData != 0xff) {
-		#ifdef BATTCHECK
-			shortClicks = clicksData;
+		#ifdef COUNT_CLICKS
+			shortClicks = clicksData & CLICKS_MASK;
+		#endif
+		#ifdef LOCKOUT
+			lockout = clicksData & LOCKED;
 		#endif
 		group = decodeGroup(groupMode);
 		mode = decodeMode(groupMode);
 		
 		getADCResult();
+		byte cap = getADCResult();	// OTC voltage, decays with off-time
 		
+		#ifdef RAMP
+			#ifdef COUNT_CLICKS
+				if (isRampMode()) shortClicks = 0;	// Clicks byte of ramp mode record holds ramp data
+			#endif
+			if (isRampMode() && (clicksData & RAMPING)) {
+				// Turning off while ramping locks the level, keep mode
+			} else
+		#endif
 		// Last on-time was short
-		if (getADCResult() > CAP_THRESHOLD) {
+		if (cap > CAP_THRESHOLD) {
 			mode = getNextMode();
-			#ifdef BATTCHECK
-				shortClicks++;
+			#ifdef COUNT_CLICKS
+				shortClicks = (shortClicks + 1) & CLICKS_MASK;
 			#endif
-		} else {
+		}
+		#ifdef PREV_THRESHOLD
+			// Last off-time was medium
+			else if (cap > PREV_THRESHOLD) {
+				mode = getPrevMode();
+				#ifdef COUNT_CLICKS
+					shortClicks = (shortClicks + 1) & CLICKS_MASK;
+				#endif
+			}
+		#endif
+		else {
 			#ifdef MEM_NEXT
 				mode = getNextMode();
 			#else
@@ -198,11 +635,34 @@ inline void eepLoad(void) {
 					mode = 0;
 				#endif
 			#endif
-			shortClicks = 0;
+			#ifdef COUNT_CLICKS
+				shortClicks = 0;
+			#endif
 		}
+		
+		// Keep mode while locked
+		#ifdef LOCKOUT
+			if (lockout) mode = decodeMode(groupMode);
+		#endif
 	}
 	
-	#ifdef BATTCHECK
+	// Start ramping when entering ramp mode, otherwise keep locked level
+	#ifdef RAMP
+		if (isRampMode()) {
+			if (mode != decodeMode(groupMode)) rampData = RAMPING;
+			else if (!(clicksData & RAMPING)) rampData = clicksData & RAMP_LEVEL;	// Keep locked level
+			else if ((rampData = rampLevel) >= LEVELS_COUNT) rampData = 0;	// Turned off while ramping, lock last saved level (lowest if none)
+			#ifdef COUNT_CLICKS
+				shortClicks = 0;	// Clicks byte holds ramp data
+			#endif
+		}
+	#endif
+	
+	#ifdef LOCKOUT
+		if (lockout) eepSaveClicks(clicksData, shortClicks);	// Locked mode stays, no new record and no waits before power-down
+		else
+	#endif
+	#ifdef COUNT_CLICKS
 		eepSave(shortClicks, group, mode); // Write mode, with short-on marker
 	#else
 		eepSave(0, group, mode);
@@ -226,6 +686,72 @@ void doImpulses(byte count, byte onTime, byte offTime) {
 }
 
 
+#ifdef RSTROBE
+/* Seed LFSR with ADC noise (two lowest bits of each conversion) */
+void seedRandom(void) {
+	byte count = 8;
+	#ifdef POWER_GATING
+		adcpowerup();
+	#endif
+	while (count--) {
+		adcread();
+		byte noise = ADCL;	// ADCL must be read before ADCH
+		lfsr = ((lfsr << 2) | (lfsr >> 6)) ^ noise ^ adcresult;
+	}
+	#ifdef POWER_GATING
+		adcpowerdown();
+	#endif
+	if (!lfsr) lfsr = 1;	// Zero state locks up LFSR
+}
+
+
+/* Step 8-bit Galois LFSR (x^8 + x^6 + x^5 + x^4 + 1, period 255) and return value in [min, max] range */
+byte getRandom(byte min, byte max) {
+	lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xb8);
+	return min + (lfsr & (max - min));
+}
+#endif
+
+
+#if defined(SOS) || defined(BEACON)
+/* Play Morse message once: dot - 1 unit, dash - 3 units, gaps - 1/3/7 units */
+void doMorse(const byte *message, byte length) {
+	while (length--) {
+		byte code = pgm_read_byte(message++);
+		byte count = code >> 5;
+		if (!count) doSleep(MORSE_UNIT * 2);	// Word space (7 units including letter gap)
+		while (count--) {
+			doImpulses(1, (code & 1) ? MORSE_UNIT * 3 : MORSE_UNIT, MORSE_UNIT);
+			code >>= 1;
+		}
+		doSleep(MORSE_UNIT * 2);	// Letter gap (3 units including element gap)
+	}
+}
+#endif
+
+
+#ifdef BATTCHECK_VOLTS
+/* Get battery voltage in decivolts, averaged over 8 ADC readings */
+byte getBatteryDecivolts(void) {
+	uint16_t sum = 4;	// Rounding
+	byte count = 8;
+	while (count--) sum += getBatteryVoltage();
+	byte voltage = sum >> 3;
+	byte decivolts = VOLTS_MIN;
+	const byte *threshold = voltageTable;
+	while (decivolts < VOLTS_MIN + sizeof(voltageTable) && voltage >= pgm_read_byte(threshold++)) decivolts++;
+	return decivolts;
+}
+
+
+/* Blink single digit, zero is shown as a short flash */
+void blinkDigit(byte digit) {
+	if (digit) doImpulses(digit, 10, 20);
+	else doImpulses(1, 1, 29);
+}
+#endif
+
+
 /* Set PWM value on pins */
 void setPWM(sbyte value) {
 	FET_PWM = 0;
@@ -240,26 +766,77 @@ void setPWM(sbyte value) {
 }
 
 
+#ifdef SOFT_START
+/* Ramp output up to value to limit inrush current, battery is not sampled meanwhile */
+void softStart(sbyte value) {
+	byte shift = SOFT_START;
+	while (shift) {
+		setPWM(value >> shift--);
+		SLEEP;
+	}
+	setPWM(value);
+}
+#endif
+
+
+#ifdef LOCKOUT
+/* Toggle lockout after LOCKOUT fast clicks and hold, stay in power-down while locked */
+inline void checkLockout(void) {
+	if (shortClicks == LOCKOUT) {
+		doSleep(LOCKTIME + 1);	// Wait until the click is held long enough
+		lockout ^= LOCKED;
+		eepSave(0, group, mode);
+	}
+	if (lockout) {
+		ADCoff;
+		powerdowninit();
+		doSleep(LOCKTIME + 1);	// Keep WDT running until on-time lock
+		WDTCR = 0;	// Stop WDT, nothing can wake up now
+		bodoff();	// BOD draws more than the rest of the MCU in power-down
+		SLEEP;
+	}
+}
+#endif
+
+
 /* The main program */
 int main(void) {
 	portinit();
+	traceinit();
+	trace(TRACE_BOOT);
 	sleepinit();
 	ACoff;
+	#ifdef POWER_GATING
+		DIDR0 = (1 << ADC1D) | (1 << ADC3D);	// Digital inputs are not used on ADC pins
+	#endif
 	
 	capadcinit();	
 	
 	eepLoad();	// Get current group and mode from EEPROM
+	#ifdef LOCKOUT
+		checkLockout();
+	#endif
+	trace(TRACE_MODE | mode);
 	byte pmode = pgm_read_byte(&groups[group][mode]);	// Get actual PWM value (or special mode code)
+	#ifdef LEVELS
+		if ((byte)(pmode - 1) < LEVELS_COUNT) pmode = pgm_read_byte(&levels[pmode - 1]);	// Level number to PWM value
+	#endif
 	
-	#ifdef BATTCHECK
-		byte lowbattCounter = 0;
+	#ifdef BATTMON
+		byte lowbattCounter = 0xff;	// First reading is taken right after output turns on (soft start) and not counted, ++ wraps it to 0
+	#endif
+	#ifdef USAGE
+		byte usageSeconds = 0;
 	#endif
 		
-	#if defined(BATTMON) || defined(BATTCHECK)
+	#if defined(BATTMON) || defined(BATTCHECK) || defined(RSTROBE)
 		batadcinit();
 	#else
 		ADCoff;
 	#endif
+	#ifdef POWER_GATING
+		adcpowerdown();
+	#endif
 		
 	pwminit();
 	
@@ -267,13 +844,25 @@ int main(void) {
 	#ifdef BATTCHECK
 		if (shortClicks >= BATTCHECK) {
 			doSleep(50);
-			byte voltage = getADCResult();
-			byte blinksCount;
-			if (voltage >= 170) blinksCount = 4;		// < 100%
-			else if (voltage >= 160) blinksCount = 3;	// < 75%
-			else if (voltage >= 145) blinksCount = 2;	// < 50%
-			else blinksCount = 1;						// < 25%
-			doImpulses(blinksCount, 10, 20);
+			#ifdef BATTCHECK_VOLTS
+				byte decivolts = getBatteryDecivolts();
+				byte volts = 0;
+				while (decivolts >= 10) {
+					decivolts -= 10;
+					volts++;
+				}
+				blinkDigit(volts);
+				doSleep(50);
+				blinkDigit(decivolts);
+			#else
+				byte voltage = getBatteryVoltage();
+				byte blinksCount;
+				if (voltage >= 170) blinksCount = 4;		// < 100%
+				else if (voltage >= 160) blinksCount = 3;	// < 75%
+				else if (voltage >= 145) blinksCount = 2;	// < 50%
+				else blinksCount = 1;						// < 25%
+				doImpulses(blinksCount, 10, 20);
+			#endif
 			doSleep(50);
 			eepSave(0, group, mode);
 		}
@@ -282,7 +871,11 @@ int main(void) {
 	// Blink for group change
 	#if (GROUPS_COUNT > 1)
 		if (mode == GROUP_CHANGE_MODE) {
-			setPWM(pmode);
+			#ifdef SOFT_START
+				softStart(pmode);
+			#else
+				setPWM(pmode);
+			#endif
 			doSleep(LOCKTIME * 2);
 			byte nextGroup = group + 1;
 			if (nextGroup >= GROUPS_COUNT) nextGroup = 0;
@@ -315,26 +908,76 @@ int main(void) {
 				} break;
 		#endif
 
-		// Simple SOS
+		// Random Strobe
+		#ifdef RSTROBE
+			case RSTROBE:
+				seedRandom();
+				while (1) {
+					doImpulses(1, getRandom(RSTROBE_ON), getRandom(RSTROBE_OFF));
+				} break;
+		#endif
+
+		// SOS
 		#ifdef SOS
 			case SOS:
 				while (1) {
-					doImpulses(3, 5, 12);
-					doSleep(25);
-					doImpulses(3, 25, 25);
-					doSleep(12);
-					doImpulses(3, 5, 12);
+					doMorse(sosMessage, sizeof(sosMessage));
 					doSleep(100);
 				} break;
 		#endif
 
+		// Morse beacon
+		#ifdef BEACON
+			case BEACON:
+				while (1) {
+					doMorse(beaconMessage, sizeof(beaconMessage));
+					doSleep(250);
+				} break;
+		#endif
+
+		// Smooth ramping, save every level to lock it on power-off
+		#ifdef RAMP
+			case RAMP:
+				if (rampData & RAMPING) {
+					byte level = 0;
+					sbyte step = 1;
+					while (1) {
+						rampSave(level);	// Level ring, mode ring record keeps RAMPING flag
+						setPWM(pgm_read_byte(&levels[level]));
+						doSleep(RAMP_STEP);
+						if (level == LEVELS_COUNT - 1) step = -1;
+						else if (!level) step = 1;
+						level += step;
+					}
+				}
+				pmode = pgm_read_byte(&levels[rampData]);	// Locked level, use as PWM value below
+		#endif
+
 		// All other: use as PWM value
 		default:
+			#ifdef LOW_CLOCK
+				if ((sbyte)pmode >= LOW_CLOCK && (sbyte)pmode < 0) clockdown();
+			#endif
+			#ifdef FAST_PWM
+				if ((sbyte)pmode > FAST_PWM) fastpwm();	// Unused AMC channel gets 1/256 spike, invisible next to FET
+			#endif
+
+			// Ramp up unless already turned on by group change blink
+			#ifdef SOFT_START
+				#if (GROUPS_COUNT > 1)
+					if (mode != GROUP_CHANGE_MODE)
+				#endif
+				softStart(pmode);
+			#endif
+			#ifdef USAGE
+				usageInit();
+			#endif
 			while (1) {
 				// Check battery
 				#ifdef BATTMON
-					if (getADCResult() < BATTMON) {
+					if (getBatteryVoltage() < BATTMON) {
 						if (++lowbattCounter > 8) {
+							trace(TRACE_LVP);
 							pmode = (pmode >> 1) + 3;
 							lowbattCounter = 0;
 						}
@@ -347,11 +990,20 @@ int main(void) {
 						turboTicks++;
 					} else {
 						if (pmode == 127) {
+							trace(TRACE_TURBO);
 							pmode = pmode >> 1;
 						}
 					}
 				#endif
 				
+				// Usage odometer
+				#ifdef USAGE
+					if (++usageSeconds >= USAGE_TICK) {
+						usageSeconds = 0;
+						addUsageTick();
+					}
+				#endif
+				
 				setPWM(pmode);
 				doSleep(50); // 1s delay
 			}
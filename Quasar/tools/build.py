@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+"""
+Multi-variant firmware build for Quasar
+
+Each config file names a board and overrides settings of its quasar.c
+the same way they would be edited by hand:
+
+  # Nanjg 105C with turbo timer
+  board = nanjg
+  mcu = attiny13a         -> -mmcu, default attiny13a, or attiny25/45/85
+  TURBO_TIMEOUT = 60      -> #define TURBO_TIMEOUT 60
+  MEM_LAST = off          -> //#define MEM_LAST
+  MEM_NEXT = on           -> #define MEM_NEXT
+  groups = {{ 6, 20, 28, 32, 0, 0, 0, 0 }, { 6, 20, 28, 32, STROBE, PSTROBE, SOS, 0 }}
+
+Variants are built in parallel with avr-gcc into <out>/<config name>.hex,
+<out>/manifest.json lists flash/RAM usage and enabled features of each.
+Mode tables are checked after preprocessing (quasar.c checks the constants):
+empty or unreachable modes, values that are neither level numbers nor enabled
+special modes, and levels that would be taken for a special mode.
+
+--define overrides a setting in every config, e.g. flash usage of the
+shipped configs with random strobe:
+  build.py --define RSTROBE=on configs/nanjg.cfg configs/a17dd-l.cfg configs/a17dd-l-tactical.cfg
+
+Usage:
+  build.py [--out Quasar/build] [--jobs N] [--cc avr-gcc] [--define NAME=VALUE] configs/*.cfg
+"""
+
+import argparse
+import concurrent.futures
+import json
+import os
+import re
+import subprocess
+import sys
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BOARDS = {
+    'a17dd-l': os.path.join(ROOT, 'A17DD-L', 'quasar.c'),
+    'nanjg': os.path.join(ROOT, 'Nanjg', 'quasar.c'),
+}
+# Flash and RAM size of supported MCUs
+MCUS = {
+    'attiny13a': (1024, 64),
+    'attiny25': (2048, 128),
+    'attiny45': (4096, 256),
+    'attiny85': (8192, 512),
+}
+MCU = 'attiny13a'
+# Same options as Release configuration of Atmel Studio projects
+CFLAGS = ['-std=gnu99', '-Os', '-DNDEBUG', '-funsigned-char', '-funsigned-bitfields',
+          '-fpack-struct', '-fshort-enums', '-Wall']
+SPECIAL_MODES = ('STROBE', 'PSTROBE', 'SOS', 'RSTROBE', 'BEACON', 'RAMP')
+FEATURES = ('STROBE', 'PSTROBE', 'SOS', 'RSTROBE', 'BEACON', 'RAMP', 'BATTMON', 'BATTCHECK', 'BATTCHECK_VOLTS',
+            'CALIBRATION', 'USAGE', 'USAGE_FLUSH', 'LOCKOUT', 'TURBO_TIMEOUT', 'SOFT_START', 'POWER_GATING',
+            'LOW_CLOCK', 'FAST_PWM', 'LEVELS', 'MEM_LAST', 'MEM_FIRST', 'MEM_NEXT', 'ONTIME_LOCK', 'LOCKTIME',
+            'CAP_THRESHOLD', 'PREV_THRESHOLD', 'PREV_TAP', 'MODES_COUNT', 'GROUPS_COUNT', 'GROUP_CHANGE_MODE',
+            'THERMAL', 'TRACE')
+
+
+def parse_config(path):
+    """Read 'name = value' lines, '#' starts a comment"""
+    config = {}
+    for number, line in enumerate(open(path), 1):
+        line = line.split('#', 1)[0].strip()
+        if not line:
+            continue
+        if '=' not in line:
+            sys.exit('%s:%d: expected name = value' % (path, number))
+        name, value = (part.strip() for part in line.split('=', 1))
+        config[name] = value
+    if config.get('board') not in BOARDS:
+        sys.exit('%s: board must be one of %s' % (path, ', '.join(BOARDS)))
+    if config.get('mcu', MCU) not in MCUS:
+        sys.exit('%s: mcu must be one of %s' % (path, ', '.join(MCUS)))
+    return config
+
+
+def patch(source, config):
+    """Apply config settings to firmware source"""
+    for name, value in config.items():
+        if name in ('board', 'mcu'):
+            continue
+        if name == 'groups':
+            source, count = re.subn(r'(groups\[GROUPS_COUNT\]\[MODES_COUNT\] = ).*?\};', r'\g<1>%s;' % value.replace('\\', r'\\'),
+                                    source, count=1, flags=re.S)
+            if not count:
+                raise ValueError('groups table not found')
+            continue
+        define = re.compile(r'^([ \t]*)(?://)?(#define[ \t]+%s)\b([ \t]+[^/\n]*?)?([ \t]*//.*)?$' % re.escape(name), re.M)
+        match = define.search(source)
+        if not match:
+            if value == 'off':
+                continue
+            line = '#define %s%s\n' % (name, '' if value == 'on' else ' ' + value)
+            source = source.replace('/* Special modes', line + '\n/* Special modes', 1)
+            continue
+        indent, keyword, old, comment = match.group(1), match.group(2), match.group(3) or '', match.group(4) or ''
+        if value == 'off':
+            line = indent + '//' + keyword + old + comment
+        elif value == 'on':
+            line = indent + keyword + old + comment
+        else:
+            spacing = re.match(r'\s*', old).group() or ' '
+            line = indent + keyword + spacing + value + comment
+        source = source[:match.start()] + line + source[match.end():]
+    return source
+
+
+def read_table(source, name):
+    """Return rows of a preprocessed PROGMEM table initializer, or None if absent"""
+    match = re.search(r'\b%s\s*(?:\[[^\]]*\]\s*)+=\s*\{(.*?)\}\s*;' % name, source, re.S)
+    if not match:
+        return None
+    rows = re.findall(r'\{([^{}]*)\}', match.group(1)) or [match.group(1)]
+    return [[int(value, 0) for value in row.replace('(', '').replace(')', '').split(',') if value.strip()] for row in rows]
+
+
+def check_tables(source, macros):
+    """Check groups and levels tables, return list of problems"""
+    problems = []
+    codes = {int(macros[name], 0): name for name in SPECIAL_MODES if name in macros}
+    levels_count = int(macros['LEVELS_COUNT']) if 'LEVELS' in macros else None
+    groups = read_table(source, 'groups') or []
+    for group, row in enumerate(groups):
+        used = row[:row.index(0)] if 0 in row else row
+        if not used:
+            problems.append('group %d: first mode is empty' % group)
+        dead = [mode for mode in range(len(used) + 1, len(row)) if row[mode]]
+        if dead:
+            problems.append('group %d: modes %s follow an empty slot and are unreachable' % (group, dead))
+        if levels_count is not None:
+            for mode, value in enumerate(row):
+                if value and value not in codes and not 1 <= value <= levels_count:
+                    problems.append('group %d mode %d: %d is neither a level number nor an enabled special mode' % (
+                        group, mode, value))
+        change = int(macros.get('GROUP_CHANGE_MODE', 0))
+        if len(groups) > 1 and change >= len(used):
+            problems.append('group %d: GROUP_CHANGE_MODE %d is empty or unreachable' % (group, change))
+    for index, value in enumerate((read_table(source, 'levels') or [[]])[0]):
+        if value in codes:
+            problems.append('levels[%d] = %d would run special mode %s' % (index, value, codes[value]))
+    return problems
+
+
+def run(command):
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    if result.returncode:
+        raise RuntimeError(result.stdout)
+    return result.stdout
+
+
+def compile_harness(name, out, include):
+    """Compile simavr harness tools/<name>.c with host gcc into <out>/<name> unless up to date"""
+    binary = os.path.join(out, name)
+    sources = [os.path.join(os.path.dirname(os.path.abspath(__file__)), source) for source in (name + '.c', 'harness.h')]
+    if not os.path.exists(binary) or os.path.getmtime(binary) < max(os.path.getmtime(source) for source in sources):
+        run(['gcc', '-O2', '-std=gnu99', '-I' + include, '-o', binary, sources[0], '-lsimavr', '-lelf'])
+    return binary
+
+
+def tool(cc, name):
+    """Binutils program of the compiler's toolchain, e.g. /opt/avr-gcc-5.4.0/bin/avr-gcc -> .../bin/avr-objcopy"""
+    head, tail = os.path.split(cc)
+    return os.path.join(head, re.sub(r'gcc(-[\d.]+)?$', name, tail))
+
+
+def build(path, out, cc, defines=None):
+    """Build one variant with optional setting overrides, return its manifest entry"""
+    name = os.path.splitext(os.path.basename(path))[0]
+    entry = build_config(name, dict(parse_config(path), **(defines or {})), out, cc)
+    entry['config'] = os.path.relpath(path)
+    return entry
+
+
+def build_config(name, config, out, cc, cflags=()):
+    """Build firmware for parsed config into <out>/<name>.hex"""
+    mcu = config.get('mcu', MCU)
+    entry = {'name': name, 'board': config['board'], 'mcu': mcu}
+    base = os.path.join(out, name)
+    cflags = ['-mmcu=' + mcu] + CFLAGS + list(cflags)
+    try:
+        source = patch(open(BOARDS[config['board']]).read(), config)
+        with open(base + '.c', 'w') as file:
+            file.write(source)
+        run([cc] + cflags + ['-o', base + '.elf', base + '.c'])
+        run([tool(cc, 'objcopy'), '-O', 'ihex', '-R', '.eeprom', base + '.elf', base + '.hex'])
+        text, data, bss = (int(v) for v in run([tool(cc, 'size'), base + '.elf']).splitlines()[1].split()[:3])
+        macros = dict(re.findall(r'^#define (\w+)(?: (.*))?$', run([cc] + cflags + ['-E', '-dM', base + '.c']), re.M))
+        preprocessed = run([cc] + cflags + ['-E', base + '.c'])
+        problems = check_tables(preprocessed, macros)
+        if problems:
+            raise ValueError('\n'.join(problems))
+    except (RuntimeError, ValueError) as error:
+        entry['error'] = str(error).strip()
+        return entry
+    entry.update({
+        'hex': os.path.relpath(base + '.hex'),
+        'flash': text + data,
+        'ram': data + bss,
+        'features': {feature: macros[feature] or True for feature in FEATURES if feature in macros},
+        'groups': read_table(preprocessed, 'groups') or [],
+    })
+    if entry['flash'] > MCUS[mcu][0]:
+        entry['error'] = 'flash %d bytes exceeds %d' % (entry['flash'], MCUS[mcu][0])
+    return entry
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--out', default=os.path.join(ROOT, 'build'), help='output directory')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count(), help='parallel builds')
+    parser.add_argument('--cc', default='avr-gcc', help='compiler, objcopy and size are derived from its name')
+    parser.add_argument('--define', action='append', default=[], help='setting NAME=VALUE (or on/off) for every config, repeatable')
+    parser.add_argument('configs', nargs='+', help='config files')
+    args = parser.parse_args()
+    defines = dict(define.split('=', 1) for define in args.define)
+
+    os.makedirs(args.out, exist_ok=True)
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        manifest = list(pool.map(lambda path: build(path, args.out, args.cc, defines), args.configs))
+    with open(os.path.join(args.out, 'manifest.json'), 'w') as file:
+        json.dump(manifest, file, indent=2)
+
+    failed = 0
+    for entry in manifest:
+        if 'error' in entry:
+            failed += 1
+            print('%-24s FAILED\n%s' % (entry['name'], entry['error']))
+        else:
+            flash, ram = MCUS[entry['mcu']]
+            print('%-24s %-9s %4d/%d bytes flash  %3d/%d bytes RAM  %s' % (
+                entry['name'], entry['mcu'], entry['flash'], flash, entry['ram'], ram, entry['hex']))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
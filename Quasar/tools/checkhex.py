@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+"""
+Reproducible-build check of the committed quasar.hex files
+
+Rebuilds A17DD-L/quasar.hex and Nanjg/quasar.hex from their quasar.c with
+the pinned avr-gcc and the Atmel Studio Release options (see build.py),
+compares flash images byte for byte and reports code size changes.
+On mismatch an instruction level diff of the disassembly is printed.
+
+Usage:
+  checkhex.py [--cc avr-gcc] [--any-version] [--update]
+
+--update replaces the committed hex files with the rebuilt ones.
+"""
+
+import argparse
+import difflib
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+import build
+
+# avr-gcc shipped with Atmel Studio 7 (AVR 8-bit toolchain 3.6), other versions produce different code
+PINNED_VERSION = '5.4.0'
+
+
+def read_flash(path):
+    """Read Intel HEX flash image as bytes"""
+    data = {}
+    for line in open(path):
+        line = line.strip()
+        if not line.startswith(':'):
+            continue
+        record = bytes.fromhex(line[1:])
+        if sum(record) & 0xff:
+            sys.exit('Bad checksum in %s: %s' % (path, line))
+        count, addr, kind = record[0], record[1] << 8 | record[2], record[3]
+        if kind == 0:
+            for i, value in enumerate(record[4:4 + count]):
+                data[addr + i] = value
+        elif kind == 1:
+            break
+    return bytes(data.get(addr, 0xff) for addr in range(max(data) + 1 if data else 0))
+
+
+def disassemble(path, objdump):
+    """Instructions of hex file without addresses, so that shifted code still lines up"""
+    lines = []
+    for line in build.run([objdump, '-m', 'avr', '-D', path]).splitlines():
+        match = re.match(r'\s*[0-9a-f]+:\t(.*)$', line)
+        if match:
+            lines.append(re.sub(r'\s*;.*$', '', match.group(1)).expandtabs().rstrip())
+    return lines
+
+
+def check(board, out, cc, update):
+    """Rebuild one board, return True when it matches the committed hex"""
+    committed = os.path.join(os.path.dirname(build.BOARDS[board]), 'quasar.hex')
+    entry = build.build_config(board, {'board': board}, out, cc)
+    if 'error' in entry:
+        print('%-8s FAILED\n%s' % (board, entry['error']))
+        return False
+    rebuilt = entry['hex']
+    old, new = read_flash(committed), read_flash(rebuilt)
+    delta = len(new) - len(old)
+    if old == new:
+        print('%-8s OK        %4d bytes' % (board, len(new)))
+        return True
+    first = next((i for i, (a, b) in enumerate(zip(old, new)) if a != b), min(len(old), len(new)))
+    print('%-8s MISMATCH  %4d -> %4d bytes (%+d), first difference at 0x%03x' % (board, len(old), len(new), delta, first))
+    objdump = build.tool(cc, 'objdump')
+    sys.stdout.writelines(line + '\n' for line in difflib.unified_diff(
+        disassemble(committed, objdump), disassemble(rebuilt, objdump),
+        os.path.relpath(committed), 'rebuilt ' + os.path.relpath(committed), lineterm=''))
+    if update:
+        shutil.copyfile(rebuilt, committed)
+        print('%-8s updated %s' % (board, os.path.relpath(committed)))
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--cc', default='avr-gcc', help='compiler, objcopy and objdump are derived from its name')
+    parser.add_argument('--any-version', action='store_true', help='do not require pinned avr-gcc version')
+    parser.add_argument('--update', action='store_true', help='replace committed hex files with rebuilt ones')
+    args = parser.parse_args()
+
+    try:
+        version = build.run([args.cc, '-dumpversion']).strip()
+    except OSError:
+        sys.exit('%s not found' % args.cc)
+    if version != PINNED_VERSION and not args.any_version:
+        sys.exit('%s is version %s, hex files are built with %s (use --any-version to compare anyway)' % (
+            args.cc, version, PINNED_VERSION))
+
+    with tempfile.TemporaryDirectory() as out:
+        results = [check(board, out, args.cc, args.update) for board in sorted(build.BOARDS)]
+    sys.exit(0 if all(results) else 1)
+
+
+if __name__ == '__main__':
+    main()
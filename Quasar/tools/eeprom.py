@@ -0,0 +1,277 @@
+#!/usr/bin/env python3
+"""
+EEPROM image tool for Quasar firmware
+
+Layout (ATtiny13A, 64 bytes):
+  0..31  wear-levelled mode ring, see eepSave()/eepLoad(): 16 two-byte records,
+         only the current one is written, the rest are erased (0xff)
+         byte 0: clicks - 0x80 short-on marker (Nanjg), 0x40 lockout,
+                 0x3f fast clicks counter (or 0x20 ramping, 0x1f level in ramp mode)
+         byte 1: group << 4 | mode
+  32..   usage odometer (USAGE), inverted 16-bit little-endian minutes per mode,
+         then owner mode of the carry and USAGE_FLUSH / 2 carry bytes: one bit
+         cleared per 15s of use, full carry adds USAGE_FLUSH minutes
+  52..59 ramp level ring (RAMP_RING), written on every ramp step: one level byte,
+         the rest erased; read when the ramp mode record has the ramping flag
+  63     battery ADC calibration byte, stored inverted (0xff - no offset)
+
+ATtiny25/45/85 builds (--mcu, Nanjg only) use a 48-byte ring of 16
+three-byte records (clicks, group, mode) in 128/256/512 bytes, USAGE and
+CALIBRATION are set past the ring in quasar.c (usage --addr defaults to 64
+there, like configs/nanjg-tiny85-full.cfg).
+
+Images are Intel HEX (.eep/.hex, as read and written by avrdude) or raw .bin.
+
+decode estimates wear. The rings keep no write count and their head only
+gives the number of saves modulo the slot count, so mode ring and ramp ring
+wear is shown as the saves or ramp steps that take a cell to its 100000
+endurance cycles. Usage counters give a lower bound for counter writes and
+carry erases (minutes / USAGE_FLUSH).
+
+Usage:
+  eeprom.py [--mcu attiny13a] <command> ...
+  eeprom.py calibrate --actual 4.02 --shown 3.9 [--in dump.eep] out.eep
+  eeprom.py calibrate --offset 5 out.eep
+  eeprom.py usage [--modes 8] [--flush 4] dump.eep
+  eeprom.py decode [--board nanjg] [--modes 8] [--flush 4] dump.eep
+  eeprom.py encode --group 1 --mode 0 [--slot 0] [--clicks 0] [--locked] [--calibration 0] out.eep
+"""
+
+import argparse
+import os
+import sys
+
+# EEPROM size, mode ring record size, ring size and default USAGE address, see RECORD_SIZE and RING_SIZE in quasar.c
+LAYOUTS = {
+    'attiny13a': (64, 2, 32, 32),
+    'attiny25': (128, 3, 48, 64),
+    'attiny45': (256, 3, 48, 64),
+    'attiny85': (512, 3, 48, 64),
+}
+EEPROM_SIZE, RECORD_SIZE, RING_SIZE, USAGE_ADDR = LAYOUTS['attiny13a']
+CALIBRATION_ADDR = 63
+RAMP_RING, RAMP_RING_SIZE = 52, 8
+USAGE_TICK = 15  # Seconds of use per carry bit
+RAMPING = 0x20
+RAMP_STEP = 3 * 2048 / 128000.0  # Ramp step time, s: RAMP_STEP WDT ticks of 16ms
+SHORT_ON = 0x80
+LOCKED = 0x40
+CLICKS_MASK = 0x3f
+ADC_STEP = 0.0218  # Volts per battery ADC step, see tools/voltage.py
+CALIBRATION_LIMIT = 16  # Largest offset in ADC steps (about 0.35V), more means a wrong divider or a misread meter
+ENDURANCE = 100000  # Erase/write cycles per EEPROM cell, datasheet minimum
+
+
+def read_image(path):
+    """Read EEPROM image, missing bytes are erased (0xff)"""
+    data = bytearray([0xff] * EEPROM_SIZE)
+    if os.path.splitext(path)[1].lower() == '.bin':
+        raw = open(path, 'rb').read()
+        data[:len(raw)] = raw[:EEPROM_SIZE]
+        return data
+    for line in open(path):
+        line = line.strip()
+        if not line.startswith(':'):
+            continue
+        record = bytes.fromhex(line[1:])
+        if sum(record) & 0xff:
+            sys.exit('Bad checksum in %s: %s' % (path, line))
+        count, addr, kind = record[0], record[1] << 8 | record[2], record[3]
+        if kind == 0:
+            for i, value in enumerate(record[4:4 + count]):
+                if addr + i < EEPROM_SIZE:
+                    data[addr + i] = value
+        elif kind == 1:
+            break
+    return data
+
+
+def write_image(path, data):
+    """Write EEPROM image as Intel HEX or raw .bin"""
+    if os.path.splitext(path)[1].lower() == '.bin':
+        open(path, 'wb').write(bytes(data))
+        return
+    with open(path, 'w') as out:
+        for addr in range(0, len(data), 16):
+            chunk = bytes(data[addr:addr + 16])
+            record = bytes([len(chunk), addr >> 8, addr & 0xff, 0]) + chunk
+            out.write(':%s%02X\n' % (record.hex().upper(), -sum(record) & 0xff))
+        out.write(':00000001FF\n')
+
+
+def load(path):
+    return read_image(path) if path else bytearray([0xff] * EEPROM_SIZE)
+
+
+def check_calibration(offset):
+    if not -CALIBRATION_LIMIT <= offset <= CALIBRATION_LIMIT:
+        sys.exit('Offset %d is out of range -%d...%d ADC steps' % (offset, CALIBRATION_LIMIT, CALIBRATION_LIMIT))
+
+
+def cmd_calibrate(args):
+    if args.offset is None:
+        if args.actual is None or args.shown is None:
+            sys.exit('Either --offset or both --actual and --shown are required')
+        args.offset = round((args.actual - args.shown) / args.step)
+    check_calibration(args.offset)
+    data = load(args.input)
+    data[CALIBRATION_ADDR] = ~args.offset & 0xff
+    write_image(args.output, data)
+    print('Calibration offset %+d ADC steps (%+.3f V)' % (args.offset, args.offset * args.step))
+
+
+def read_usage(data, base, modes, flush):
+    """Return usage odometer minutes per mode, owner mode of the carry and carried seconds"""
+    counters = [~(data[base + mode * 2] | data[base + mode * 2 + 1] << 8) & 0xffff for mode in range(modes)]
+    carry = data[base + modes * 2 + 1:base + modes * 2 + 1 + flush // 2]
+    return counters, data[base + modes * 2], sum(bin(value ^ 0xff).count('1') for value in carry) * USAGE_TICK
+
+
+def cmd_usage(args):
+    data = read_image(args.image)
+    counters, owner, carried = read_usage(data, USAGE_ADDR if args.addr is None else args.addr, args.modes, args.flush)
+    total = sum(counters)
+    print('Mode  Minutes     Hours  Share')
+    for mode, minutes in enumerate(counters):
+        share = 100 * minutes / total if total else 0
+        print('%4d  %7d  %8.1f  %4.0f%%%s' % (mode, minutes, minutes / 60, share, '  (saturated)' if minutes == 0xffff else ''))
+    print('Total %6d  %8.1f' % (total, total / 60))
+    if carried:
+        print('Carry %ds of mode %d, not yet in its counter' % (carried, owner))
+
+
+def find_head(data):
+    """Find current record like eepLoad() does, return its address or None"""
+    pos = 0
+    step = 1 if RECORD_SIZE == 2 else RECORD_SIZE
+    while data[pos] == 0xff and pos < RING_SIZE - RECORD_SIZE:
+        pos += step
+    return pos if data[pos] != 0xff else None
+
+
+def decode_record(data, pos):
+    """Return group and mode of record"""
+    if RECORD_SIZE == 2:
+        return data[pos + 1] >> 4, data[pos + 1] & 0xf
+    return data[pos + 1], data[pos + 2]
+
+
+def cmd_decode(args):
+    data = read_image(args.image)
+    head = find_head(data)
+    ring = ''.join('.' if all(b == 0xff for b in data[i:i + RECORD_SIZE]) else '#' for i in range(0, RING_SIZE, RECORD_SIZE))
+    print('Ring:        [%s] (# - written record)' % ring)
+    if ring.count('#') > 1:
+        print('Warning:     %d records present, write was interrupted' % ring.count('#'))
+    if head is None:
+        print('Head:        none, erased ring (first boot)')
+    else:
+        clicks = data[head]
+        print('Head:        address %d, slot %d, next write to slot %d' % (
+            head, head // RECORD_SIZE, (head + RECORD_SIZE) % RING_SIZE // RECORD_SIZE))
+        print('Group/mode:  %d/%d' % decode_record(data, head))
+        print('Clicks byte: 0x%02x - %d fast clicks%s%s' % (
+            clicks, clicks & CLICKS_MASK,
+            ', locked' if clicks & LOCKED else '',
+            ', short-on marker' if args.board == 'nanjg' and clicks & SHORT_ON else ''))
+        if head % RECORD_SIZE:
+            print('Warning:     head is not aligned to a record')
+    levels = [i for i in range(RAMP_RING_SIZE) if data[RAMP_RING + i] != 0xff]
+    if levels:
+        print('Ramp ring:   [%s] level %d%s' % (
+            ''.join('#' if i in levels else '.' for i in range(RAMP_RING_SIZE)), data[RAMP_RING + levels[0]],
+            ', locked on power-on if ramp mode record has ramping flag 0x%02x' % RAMPING))
+    offset = ~data[CALIBRATION_ADDR] & 0xff
+    offset = offset - 256 if offset > 127 else offset
+    print('Calibration: %+d ADC steps (%+.3f V)' % (offset, offset * ADC_STEP))
+
+    # Rings keep no write count: the head only gives saves modulo the slot count
+    slots = RING_SIZE // RECORD_SIZE
+    print('Wear:        mode ring not derivable from an image, a slot takes 1 of %d saves and reaches %d cycles' % (
+        slots, ENDURANCE))
+    print('             after %d saves (1-2 per power-on, more on group change or lockout)' % (
+        slots * ENDURANCE))
+    if levels:
+        print('             ramp ring not derivable either, a cell takes 1 of %d ramp steps (%.0fh of ramping)' % (
+            RAMP_RING_SIZE, RAMP_RING_SIZE * ENDURANCE * RAMP_STEP / 3600.0))
+    base = USAGE_ADDR if args.addr is None else args.addr
+    if any(value != 0xff for value in data[base:base + args.modes * 2 + 1 + args.flush // 2]):
+        counters, owner, carried = read_usage(data, base, args.modes, args.flush)
+        mode = max(range(args.modes), key=lambda m: counters[m])
+        writes, erases = counters[mode] // args.flush, sum(counters) // args.flush
+        print('             usage counter of mode %d at least %d writes (%.1f%%), carry bytes at least %d erases (%.1f%%)' % (
+            mode, writes, 100.0 * writes / ENDURANCE, erases, 100.0 * erases / ENDURANCE))
+
+
+def cmd_encode(args):
+    limit = 16 if RECORD_SIZE == 2 else 256
+    if not 0 <= args.group < limit or not 0 <= args.mode < limit or not 0 <= args.clicks <= CLICKS_MASK:
+        sys.exit('Group, mode or clicks out of range')
+    data = load(args.input)
+    data[:RING_SIZE] = bytes([0xff] * RING_SIZE)
+    addr = args.slot % (RING_SIZE // RECORD_SIZE) * RECORD_SIZE
+    data[addr] = args.clicks | (LOCKED if args.locked else 0)
+    if RECORD_SIZE == 2:
+        data[addr + 1] = args.group << 4 | args.mode
+    else:
+        data[addr + 1], data[addr + 2] = args.group, args.mode
+    if args.calibration is not None:
+        check_calibration(args.calibration)
+        data[CALIBRATION_ADDR] = ~args.calibration & 0xff
+    write_image(args.output, data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--mcu', choices=sorted(LAYOUTS), default='attiny13a', help='EEPROM layout of this MCU build')
+    commands = parser.add_subparsers(dest='command')
+    commands.required = True
+
+    calibrate = commands.add_parser('calibrate', help='set battery ADC calibration byte')
+    calibrate.add_argument('--actual', type=float, help='cell voltage measured with a meter, V')
+    calibrate.add_argument('--shown', type=float, help='voltage shown by uncalibrated BATTCHECK_VOLTS, V')
+    calibrate.add_argument('--offset', type=int, help='offset in ADC steps instead of --actual/--shown')
+    calibrate.add_argument('--step', type=float, default=ADC_STEP, help='volts per ADC step')
+    calibrate.add_argument('--in', dest='input', help='image to modify instead of an erased one')
+    calibrate.add_argument('output', help='output image')
+    calibrate.set_defaults(func=cmd_calibrate)
+
+    usage = commands.add_parser('usage', help='report usage odometer')
+    usage.add_argument('--modes', type=int, default=8, help='MODES_COUNT')
+    usage.add_argument('--flush', type=int, default=4, help='USAGE_FLUSH, carry is USAGE_FLUSH / 2 bytes')
+    usage.add_argument('--addr', type=int, help='USAGE address, default %d (%d on ATtiny25/45/85)' % (
+        LAYOUTS['attiny13a'][3], LAYOUTS['attiny85'][3]))
+    usage.add_argument('image', help='EEPROM dump')
+    usage.set_defaults(func=cmd_usage)
+
+    decode = commands.add_parser('decode', help='show ring head, written slots, decoded state and wear estimate')
+    decode.add_argument('--board', choices=('a17dd-l', 'nanjg'), help='default a17dd-l, nanjg on ATtiny25/45/85')
+    decode.add_argument('--modes', type=int, default=8, help='MODES_COUNT for usage odometer wear')
+    decode.add_argument('--flush', type=int, default=4, help='USAGE_FLUSH for usage odometer wear')
+    decode.add_argument('--addr', type=int, help='USAGE address, default as in usage')
+    decode.add_argument('image', help='EEPROM dump')
+    decode.set_defaults(func=cmd_decode)
+
+    encode = commands.add_parser('encode', help='build preset image for provisioning')
+    encode.add_argument('--group', type=int, default=0)
+    encode.add_argument('--mode', type=int, default=0)
+    encode.add_argument('--slot', type=int, default=0, help='ring slot 0...15 for the record')
+    encode.add_argument('--clicks', type=int, default=0, help='fast clicks counter')
+    encode.add_argument('--locked', action='store_true', help='ship in lockout')
+    encode.add_argument('--calibration', type=int, help='calibration offset in ADC steps')
+    encode.add_argument('--in', dest='input', help='image to modify instead of an erased one')
+    encode.add_argument('output', help='output image')
+    encode.set_defaults(func=cmd_encode)
+
+    args = parser.parse_args()
+    if args.command == 'decode' and args.board is None:
+        args.board = 'a17dd-l' if args.mcu == 'attiny13a' else 'nanjg'
+    if getattr(args, 'board', None) == 'a17dd-l' and args.mcu != 'attiny13a':
+        parser.error('A17DD-L firmware is for ATtiny13A only')
+    global EEPROM_SIZE, RECORD_SIZE, RING_SIZE, USAGE_ADDR
+    EEPROM_SIZE, RECORD_SIZE, RING_SIZE, USAGE_ADDR = LAYOUTS[args.mcu]
+    args.func(args)
+
+
+if __name__ == '__main__':
+    main()
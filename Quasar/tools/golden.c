@@ -0,0 +1,71 @@
+/*
+ * Deterministic output recorder for Quasar golden-trace checks in simavr
+ *
+ * Runs a SIMAVR ELF for a fixed number of MCU cycles (no wall clock), and
+ * logs every change of TCCR0A, OCR0A and OCR0B and every EEPROM erase or
+ * write with its time. The same firmware always gives the same log, so
+ * tools/golden.py can compare it line by line with the checked-in trace.
+ *
+ * Build:
+ * > gcc -O2 -I/usr/include/simavr -o golden golden.c -lsimavr -lelf
+ * Usage:
+ * > golden quasar.elf seconds [resolution_us]
+ * Output: 'microseconds TCCR0A|OCR0A|OCR0B value' or 'microseconds EEPROM address value erase|write|erase+write'
+ */
+
+#include "harness.h"
+#include "sim_io.h"
+
+static unsigned long resolution = 1;	// Time step of the log, us
+static int last[256];	// Last logged value per register, -1 before first write
+
+
+static unsigned long long getTime(avr_t * avr) {
+	return avr->cycle * 1000000ULL / avr->frequency / resolution * resolution;
+}
+
+
+/* Register write hook, simavr chains it with the peripheral's own handler */
+static void onWrite(avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param) {
+	if (v == last[addr]) return;
+	last[addr] = v;
+	printf("%llu %s %u\n", getTime(avr), (const char *)param, v);
+}
+
+
+/* EECR write hook, logs programming operations when EEPE is set */
+static void onEeprom(avr_t * avr, avr_io_addr_t addr, uint8_t v, void * param) {
+	static const char * const modes[] = { "erase+write", "erase", "write", "reserved" };
+	(void)addr; (void)param;
+	if (!(v & 2)) return;
+	printf("%llu EEPROM %u %u %s\n", getTime(avr), avr->data[EEARL], avr->data[EEDR], modes[(v >> 4) & 3]);
+}
+
+
+int main(int argc, char * argv[]) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s quasar.elf seconds [resolution_us]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 3) resolution = strtoul(argv[3], NULL, 0);
+	if (!resolution) resolution = 1;
+
+	const registers_t * regs;
+	avr_t * avr = loadFirmware(argv[1], &regs);
+
+	memset(last, -1, sizeof(last));
+	avr_register_io_write(avr, regs->tccr0a, onWrite, "TCCR0A");
+	avr_register_io_write(avr, regs->ocr0a, onWrite, "OCR0A");
+	avr_register_io_write(avr, regs->ocr0b, onWrite, "OCR0B");
+	avr_register_io_write(avr, EECR, onEeprom, NULL);
+
+	avr_cycle_count_t end = (avr_cycle_count_t)(atof(argv[2]) * avr->frequency);
+	while (avr->cycle < end) {
+		int state = avr_run(avr);
+		if (state == cpu_Done || state == cpu_Crashed) {
+			fprintf(stderr, "Firmware stopped at cycle %llu\n", (unsigned long long)avr->cycle);
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""
+Golden-trace regression check of Quasar firmware
+
+Builds a SIMAVR ELF for every used groups[][] slot of each board (booting into
+it after a long off-time, like mode scenarios of tools/simulate.py), runs it
+for a fixed number of simulated seconds with tools/golden.c and compares the
+TCCR0A/OCR0A/OCR0B timeline and EEPROM writes with golden/<board>-g<group>m<mode>.trace.
+Changes to doImpulses(), doSleep(), soft start or EEPROM commits show up as
+a diff of the first differing lines.
+
+Traces depend on the compiler, record and compare them with the avr-gcc
+pinned in tools/checkhex.py. After an intended timing change, review the diff
+and record new traces with --update.
+
+Usage:
+  golden.py [--board nanjg] [--seconds 3] [--resolution 1] [--jobs N] [--update] [--simavr-include /usr/include/simavr]
+"""
+
+import argparse
+import concurrent.futures
+import difflib
+import os
+import subprocess
+import sys
+
+import build
+import checkhex
+
+GOLDEN = os.path.join(build.ROOT, 'golden')
+
+
+def config(board, group, mode):
+    return {'board': board, 'SIMAVR': 'on', 'SIM_GROUP': str(group), 'SIM_MODE': str(mode), 'SIM_CLICKS': '0'}
+
+
+def record(recorder, board, group, mode, args):
+    """Build and run one entry, return (label, trace lines or error string)"""
+    label = '%s-g%dm%d' % (board, group, mode)
+    entry = build.build_config(label, config(board, group, mode), args.out, args.cc,
+                               ['-I' + os.path.join(args.simavr_include, 'avr')])
+    if 'error' in entry:
+        return label, entry['error']
+    try:
+        output = subprocess.run([recorder, label + '.elf', str(args.seconds), str(args.resolution)], cwd=args.out,
+                                stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True, check=True).stdout
+    except subprocess.CalledProcessError as error:
+        return label, error.stderr
+    header = '# %s seconds=%g resolution=%d' % (label, args.seconds, args.resolution)
+    return label, [header] + output.splitlines()
+
+
+def compare(label, trace, update):
+    """Compare trace with golden file, return True when equal"""
+    path = os.path.join(GOLDEN, label + '.trace')
+    golden = open(path).read().splitlines() if os.path.exists(path) else None
+    if golden == trace:
+        print('%-16s OK       %5d events' % (label, len(trace) - 1))
+        return True
+    if update:
+        os.makedirs(GOLDEN, exist_ok=True)
+        with open(path, 'w') as file:
+            file.writelines(line + '\n' for line in trace)
+        print('%-16s UPDATED  %5d events' % (label, len(trace) - 1))
+        return True
+    if golden is None:
+        print('%-16s MISSING  %s, record with --update' % (label, os.path.relpath(path)))
+        return False
+    print('%-16s MISMATCH' % label)
+    diff = list(difflib.unified_diff(golden, trace, os.path.relpath(path), 'simulated', n=2, lineterm=''))
+    sys.stdout.writelines(line + '\n' for line in diff[:40])
+    if len(diff) > 40:
+        print('... %d more diff lines' % (len(diff) - 40))
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--board', action='append', choices=sorted(build.BOARDS), help='default all boards')
+    parser.add_argument('--seconds', type=float, default=3, help='simulated time per entry')
+    parser.add_argument('--resolution', type=int, default=1, help='time step of traces in microseconds')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count(), help='parallel simulations')
+    parser.add_argument('--update', action='store_true', help='record new golden traces where they differ')
+    parser.add_argument('--out', default=os.path.join(build.ROOT, 'build', 'golden'), help='output directory')
+    parser.add_argument('--cc', default='avr-gcc')
+    parser.add_argument('--any-version', action='store_true', help='do not require pinned avr-gcc version')
+    parser.add_argument('--simavr-include', default='/usr/include/simavr', help='directory containing sim_avr.h')
+    args = parser.parse_args()
+
+    try:
+        version = build.run([args.cc, '-dumpversion']).strip()
+    except (OSError, RuntimeError):
+        sys.exit('%s not found' % args.cc)
+    if version != checkhex.PINNED_VERSION and not args.any_version:
+        sys.exit('%s is version %s, golden traces are recorded with %s (use --any-version to compare anyway)' % (
+            args.cc, version, checkhex.PINNED_VERSION))
+
+    os.makedirs(args.out, exist_ok=True)
+    try:
+        recorder = build.compile_harness('golden', args.out, args.simavr_include)
+    except (RuntimeError, OSError) as error:
+        sys.exit('Unable to build recorder\n%s' % error)
+
+    entries = []
+    for board in args.board or sorted(build.BOARDS):
+        probe = build.build_config('%s-probe' % board, config(board, 0, 0), args.out, args.cc,
+                                   ['-I' + os.path.join(args.simavr_include, 'avr')])
+        if 'error' in probe:
+            sys.exit(probe['error'])
+        # Used slots of groups[][], rows missing from the initializer are empty
+        entries += [(board, g, m) for g, row in enumerate(probe['groups']) for m, value in enumerate(row) if value]
+
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        results = pool.map(lambda entry: record(recorder, entry[0], entry[1], entry[2], args), entries)
+        failed = 0
+        for label, trace in results:
+            if isinstance(trace, str):
+                print('%-16s FAILED\n%s' % (label, trace.strip()))
+                failed += 1
+            elif not compare(label, trace, args.update):
+                failed += 1
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
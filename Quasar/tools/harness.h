@@ -0,0 +1,55 @@
+/*
+ * Shared simavr setup of Quasar host harnesses (golden.c, profile.c, runtime.c)
+ *
+ * Loads a SIMAVR ELF built by tools/build.py and maps the registers the
+ * harnesses watch for the simulated MCU. Harnesses are compiled by
+ * build.compile_harness() with -I pointing to the simavr headers.
+ */
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+
+/* Data space addresses */
+typedef struct {
+	uint8_t tccr0a, tccr0b, ocr0a, ocr0b, mcucr, adcsra, prr, clkpr;
+} registers_t;
+static const registers_t tiny13 = { 0x4f, 0x53, 0x56, 0x49, 0x55, 0x26, 0x45, 0x46 };
+static const registers_t tinyx5 = { 0x4a, 0x53, 0x49, 0x48, 0x55, 0x26, 0x40, 0x46 };
+#define EECR	0x3c	// Same on ATtiny13 and ATtiny25/45/85
+#define EEDR	0x3d
+#define EEARL	0x3e
+
+
+/* Sleep callback that returns at once, simavr's default sleeps in wall time (usleep) */
+static void noSleep(avr_t * avr, avr_cycle_count_t howLong) {
+	(void)avr; (void)howLong;
+}
+
+
+/* Load ELF into a new MCU of its AVR_MCU section (ATtiny13 by default), exit on failure */
+static avr_t * loadFirmware(const char * path, const registers_t ** regs) {
+	elf_firmware_t firmware = {{0}};
+	if (elf_read_firmware(path, &firmware)) {
+		fprintf(stderr, "Unable to load %s\n", path);
+		exit(1);
+	}
+	avr_t * avr = avr_make_mcu_by_name(firmware.mmcu[0] ? firmware.mmcu : "attiny13");
+	if (!avr) {
+		fprintf(stderr, "Unknown MCU %s\n", firmware.mmcu);
+		exit(1);
+	}
+	avr_init(avr);
+	avr->sleep = noSleep;	// Run as fast as possible, time is counted in cycles
+	avr_load_firmware(avr, &firmware);
+	if (!avr->frequency) avr->frequency = 4800000;
+	*regs = strncmp(avr->mmcu, "attiny13", 8) ? &tinyx5 : &tiny13;
+	return avr;
+}
+
+#endif
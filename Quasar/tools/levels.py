@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""
+Perceptual brightness table generator for Quasar firmware LEVELS option
+
+Level N of LEVELS_COUNT is spaced logarithmically in output current between
+the lowest and the highest level, so every step looks equally bright
+(Weber-Fechner). Output current is modelled as PWM duty (value * 2 + 1) / 256
+for A17DD-L (one AMC7135 below FET, FET is FET_RATIO times stronger) and
+value / 255 for Nanjg.
+
+8-bit PWM has no values between the lowest logarithmic steps: with a floor
+of 1 and 32 levels, steps of levels 1...16 (Nanjg, values 1...17) or 1...9
+(A17DD-L, -1...-10) are below one PWM value. Those levels are forced one PWM
+value apart, so they are linear and brighter than the logarithmic curve
+(1 -> 2 doubles, 16 -> 17 adds 6%), the curve is logarithmic above them.
+The forced range is printed with the table. A higher --floor gives a fully
+logarithmic table at the cost of the moon level (about 9 for 32 levels),
+fewer levels (--count) shrink the forced range.
+
+Usage:
+  levels.py a17dd-l [--count 32] [--floor 1] [--fet-ratio 10]
+  levels.py nanjg [--count 32] [--floor 1]
+"""
+
+import argparse
+import sys
+
+A17_SPECIAL = range(120, 127)  # Keep clear of A17DD-L special mode codes
+NANJG_SPECIAL = range(248, 255)  # Keep clear of Nanjg special mode codes
+
+
+def a17_output(value, ratio):
+    """Relative output of signed A17DD-L value (negative - AMC, positive - FET)"""
+    duty = (abs(value) * 2 + 1) / 256
+    return duty * ratio if value > 0 else duty
+
+
+def a17_table(count, ratio, floor):
+    choices = [v for v in range(-127, 128) if v and v not in A17_SPECIAL and (v > 0 or -v >= floor)]
+    choices.sort(key=lambda v: a17_output(v, ratio))
+    table, forced = pick(choices, lambda v: a17_output(v, ratio), count)
+    handoff = max(i for i, v in enumerate(table) if v < 0)
+    table[handoff] = -127  # Full AMC before handoff to FET
+    return table, forced
+
+
+def nanjg_table(count, floor):
+    choices = [v for v in range(floor, 256) if v not in NANJG_SPECIAL]
+    return pick(choices, lambda v: v / 255, count)
+
+
+def pick(choices, output, count):
+    """Pick closest available value for every logarithmic step, return table and count of levels forced one value up"""
+    low, high = output(choices[0]), output(choices[-1])
+    table, forced = [], 0
+    for i in range(count):
+        target = low * (high / low) ** (i / (count - 1))
+        value = min(choices, key=lambda v: abs(output(v) / target - 1))
+        if table and output(value) <= output(table[-1]):
+            value = choices[choices.index(table[-1]) + 1]  # Step is below one PWM value
+            forced = i + 1
+        table.append(value)
+    return table, forced
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('board', choices=('a17dd-l', 'nanjg'))
+    parser.add_argument('--count', type=int, default=32, help='LEVELS_COUNT')
+    parser.add_argument('--floor', type=int, default=1, help='lowest PWM value (AMC value on A17DD-L)')
+    parser.add_argument('--fet-ratio', type=float, default=10, help='FET output relative to one AMC7135')
+    args = parser.parse_args()
+
+    if args.board == 'a17dd-l':
+        table, forced = a17_table(args.count, args.fet_ratio, args.floor)
+        kind = 'sbyte'
+    else:
+        table, forced = nanjg_table(args.count, args.floor)
+        kind = 'byte'
+    if len(set(table)) != len(table):
+        sys.exit('Too many levels for available PWM values')
+    if forced:
+        print('// Levels 1...%d are one PWM value apart (linear), logarithmic above' % forced)
+    else:
+        print('// All levels are logarithmic')
+    print('#define LEVELS_COUNT\t%d' % args.count)
+    print('PROGMEM const %s levels[LEVELS_COUNT] = { %s };' % (kind, ', '.join(str(v) for v in table)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""
+Morse message encoder for Quasar firmware SOS/BEACON modes
+
+Each character is packed into one byte 0bLLLEEEEE: L - elements count,
+E - elements starting from LSB (0 - dot, 1 - dash). Zero byte is a word space.
+
+Usage:
+  morse.py encode "CQ DE QUASAR"      print PROGMEM initializer for the message
+  morse.py roundtrip "CQ DE QUASAR"   render firmware waveform and decode it back
+"""
+
+import sys
+
+CODES = {
+    'A': '.-', 'B': '-...', 'C': '-.-.', 'D': '-..', 'E': '.', 'F': '..-.', 'G': '--.', 'H': '....',
+    'I': '..', 'J': '.---', 'K': '-.-', 'L': '.-..', 'M': '--', 'N': '-.', 'O': '---', 'P': '.--.',
+    'Q': '--.-', 'R': '.-.', 'S': '...', 'T': '-', 'U': '..-', 'V': '...-', 'W': '.--', 'X': '-..-',
+    'Y': '-.--', 'Z': '--..', '0': '-----', '1': '.----', '2': '..---', '3': '...--', '4': '....-',
+    '5': '.....', '6': '-....', '7': '--...', '8': '---..', '9': '----.', '/': '-..-.',
+}
+
+
+def encode(text):
+    """Pack text into firmware message bytes"""
+    data = []
+    for char in ' '.join(text.upper().split()):
+        if char == ' ':
+            data.append(0)
+            continue
+        if char not in CODES:
+            raise ValueError('No Morse code for %r' % char)
+        code = CODES[char]
+        bits = sum(1 << i for i, element in enumerate(code) if element == '-')
+        data.append(len(code) << 5 | bits)
+    return data
+
+
+def render(data, unit=1):
+    """Model doMorse(): return list of (level, ticks) the firmware drives on the output"""
+    wave = []
+
+    def emit(level, ticks):
+        if wave and wave[-1][0] == level:
+            wave[-1] = (level, wave[-1][1] + ticks)
+        else:
+            wave.append((level, ticks))
+
+    for code in data:
+        count = code >> 5
+        if not count:
+            emit(0, unit * 2)
+        for i in range(count):
+            emit(1, unit * 3 if code >> i & 1 else unit)
+            emit(0, unit)
+        emit(0, unit * 2)
+    return wave
+
+
+def decode(wave, unit=1):
+    """Decode (level, ticks) waveform back to text"""
+    symbols = {code: char for char, code in CODES.items()}
+    text, element = '', ''
+    for level, ticks in wave:
+        units = round(ticks / unit)
+        if level:
+            element += '-' if units >= 2 else '.'
+        elif units >= 3:
+            text += symbols.get(element, '?')
+            element = ''
+            if units >= 5:
+                text += ' '
+    if element:
+        text += symbols.get(element, '?')
+    return text.strip()
+
+
+def main(argv):
+    if len(argv) != 3 or argv[1] not in ('encode', 'roundtrip'):
+        sys.exit(__doc__)
+    data = encode(argv[2])
+    text = ' '.join(argv[2].upper().split())
+    if argv[1] == 'encode':
+        print('{ %s };\t// %s' % (', '.join('0x%02x' % b for b in data), text))
+        return
+    decoded = decode(render(data, 5), 5)
+    print(decoded)
+    if decoded != text:
+        sys.exit('Round trip mismatch: %r != %r' % (decoded, text))
+
+
+if __name__ == '__main__':
+    main(sys.argv)
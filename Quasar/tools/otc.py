@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""
+Off-time capacitor (OTC) model for tuning A17DD-L CAP_THRESHOLD
+
+chargecap() drives the OTC pin to MCU supply (cell voltage after the
+reverse polarity diode) while the light is on. After power is cut, the cap
+discharges through its bleeder resistor and pin leakage:
+  V(t) = (V0 + I*R) * exp(-t / (R*C)) - I*R
+On next power-on eepLoad() reads it on ADC3 against the 1.1V internal
+reference, left-adjusted to 8 bits, after the start-up delay of the SUT
+fuses. Reading above CAP_THRESHOLD is a short off (next mode), above
+PREV_THRESHOLD a medium off (previous mode), else a long off (memory).
+With ONTIME_LOCK the cap is driven low after LOCKTIME, so any click held
+longer than LOCKTIME / 50 s reads as a long off regardless of these bands.
+
+Component values are drawn uniformly within their tolerances for --units
+simulated drivers (fixed seed, so results are repeatable). Reported are the
+off-time boundaries of each band across units, the share of units per band
+for a sweep of off-times, and thresholds that put the median boundary on
+--target (and --prev-target) seconds. Bands are crisp when the slowest unit
+still reads short before the fastest unit reads medium.
+
+Defaults are typical, not measured: fit --capacitance, --resistance and
+--leakage to a scope capture of the OTC pin of your board.
+
+Usage:
+  otc.py [--capacitance 1.0] [--resistance 330] [--leakage 0.05] [--target 0.5] [--prev-target 1.5] [--units 1000]
+"""
+
+import argparse
+import math
+import os
+import random
+import re
+import sys
+
+import build
+
+SOURCE = build.BOARDS['a17dd-l']
+
+
+def setting(name):
+    """Value of an enabled #define in A17DD-L quasar.c, or None"""
+    match = re.search(r'^#define\s+%s\s+(\d+)' % name, open(SOURCE).read(), re.M)
+    return int(match.group(1)) if match else None
+
+
+def spread(nominal, tolerance, rng):
+    return nominal * (1 + rng.uniform(-tolerance, tolerance))
+
+
+def make_units(args):
+    """Random drivers within component tolerances: (V0, R*C, I*R, Vref)"""
+    rng = random.Random(args.seed)
+    units = []
+    for _ in range(args.units):
+        r = spread(args.resistance * 1e3, args.resistance_tol, rng)
+        c = spread(args.capacitance * 1e-6, args.capacitance_tol, rng)
+        leakage = rng.uniform(0, 2 * args.leakage) * 1e-6
+        v0 = rng.uniform(args.cell_min, args.cell_max) - spread(args.diode, 0.2, rng)
+        vref = rng.uniform(1.0, 1.2)  # ATtiny13A bandgap reference limits
+        units.append((v0, r * c, leakage * r, vref))
+    return units
+
+
+def reading(unit, seconds, startup):
+    """ADC reading of the OTC after given off-time"""
+    v0, tau, ir, vref = unit
+    volts = (v0 + ir) * math.exp(-(seconds + startup) / tau) - ir
+    return min(255, max(0, int(volts / vref * 256)))
+
+
+def boundary(unit, threshold, startup):
+    """Longest off-time that still reads above threshold, seconds"""
+    v0, tau, ir, vref = unit
+    volts = (threshold + 1) * vref / 256
+    if volts >= v0:
+        return 0
+    return max(0, tau * math.log((v0 + ir) / (volts + ir)) - startup)
+
+
+def quantiles(values):
+    values = sorted(values)
+    return values[len(values) // 20], values[len(values) // 2], values[len(values) * 19 // 20]
+
+
+def suggest(units, target, startup, below=255):
+    """Threshold with median boundary closest to target"""
+    return min(range(1, below), key=lambda t: abs(quantiles([boundary(u, t, startup) for u in units])[1] - target))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--capacitance', type=float, default=1.0, help='OTC capacitor, uF')
+    parser.add_argument('--capacitance-tol', type=float, default=0.1, help='relative tolerance')
+    parser.add_argument('--resistance', type=float, default=330, help='bleeder resistor (parallel to pin input), kOhm')
+    parser.add_argument('--resistance-tol', type=float, default=0.05, help='relative tolerance')
+    parser.add_argument('--leakage', type=float, default=0.05, help='mean pin and capacitor leakage, uA (0...2x mean)')
+    parser.add_argument('--cell-min', type=float, default=3.0, help='lowest cell voltage in use, V')
+    parser.add_argument('--cell-max', type=float, default=4.2, help='highest cell voltage in use, V')
+    parser.add_argument('--diode', type=float, default=0.25, help='reverse polarity diode drop, V (+-20%%)')
+    parser.add_argument('--startup', type=float, default=0.004, help='power-on to OTC read delay, s (SUT fuses)')
+    parser.add_argument('--threshold', type=int, default=setting('CAP_THRESHOLD'), help='default from quasar.c')
+    parser.add_argument('--prev', type=int, default=setting('PREV_THRESHOLD'), help='PREV_THRESHOLD, default from quasar.c')
+    parser.add_argument('--target', type=float, default=0.5, help='wanted short off-time boundary, s')
+    parser.add_argument('--prev-target', type=float, default=1.5, help='wanted medium off-time boundary, s')
+    parser.add_argument('--units', type=int, default=1000, help='simulated drivers')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    if args.threshold is None or not 0 < args.threshold < 255:
+        sys.exit('CAP_THRESHOLD not found in %s, pass --threshold' % os.path.relpath(SOURCE))
+
+    units = make_units(args)
+    bands = [('short', args.threshold)] + ([('medium', args.prev)] if args.prev else [])
+    print('%d units, C %.2fuF +-%d%%, R %gk +-%d%%, leakage %.2fuA, cell %.1f...%.1fV, LOCKTIME %s' % (
+        args.units, args.capacitance, args.capacitance_tol * 100, args.resistance, args.resistance_tol * 100,
+        args.leakage, args.cell_min, args.cell_max, setting('LOCKTIME')))
+    print('\n%-8s %9s %8s %8s %8s' % ('band', 'threshold', 'p5', 'median', 'p95'))
+    limits = []
+    for name, threshold in bands:
+        low, median, high = quantiles([boundary(u, threshold, args.startup) for u in units])
+        limits.append((low, high))
+        print('%-8s %9d %7.2fs %7.2fs %7.2fs' % (name, threshold, low, median, high))
+    if len(limits) > 1 and limits[0][1] >= limits[1][0]:
+        print('Bands overlap: slow units read short where fast units already read medium')
+
+    print('\n%-8s %7s %7s %7s' % ('off', 'short', 'medium', 'long'))
+    longest = max(high for _, high in limits) * 1.5
+    for step in range(1, 21):
+        seconds = longest * step / 20
+        counts = [0, 0, 0]
+        for unit in units:
+            value = reading(unit, seconds, args.startup)
+            counts[0 if value > args.threshold else 1 if args.prev and value > args.prev else 2] += 1
+        print('%6.2fs %6.1f%% %6.1f%% %6.1f%%' % ((seconds,) + tuple(100.0 * c / len(units) for c in counts)))
+
+    print()
+    best = suggest(units, args.target, args.startup)
+    suggestions = [('CAP_THRESHOLD', 'short', best, args.target)]
+    if args.prev:
+        suggestions.append(('PREV_THRESHOLD', 'medium', suggest(units, args.prev_target, args.startup, best),
+                            args.prev_target))
+    for name, band, threshold, target in suggestions:
+        low, median, high = quantiles([boundary(u, threshold, args.startup) for u in units])
+        print('%s %d puts %s off at %.2fs (p5 %.2fs, p95 %.2fs)' % (name, threshold, band, median, low, high))
+        if abs(median - target) > target / 10:
+            print('  %.2fs is out of reach of the ADC range with these components' % target)
+        elif threshold < 16:
+            print('  few ADC counts left at this off-time, use a larger capacitor or bleeder resistor')
+
+
+if __name__ == '__main__':
+    main()
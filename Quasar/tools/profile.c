@@ -0,0 +1,179 @@
+/*
+ * Cycle profiler for Quasar firmware in simavr
+ *
+ * Runs an ELF for the given simulated time and attributes every CPU cycle to
+ * the function containing PC, or to sleep. Symbols are read with avr-nm.
+ * Cycles are also attributed to power states for the MCU current model of
+ * tools/profile.py: awake or sleep mode (MCUCR SM bits) per CLKPR divider,
+ * ADC enabled and powered (ADEN set, PRADC clear) in any state, and boot
+ * time until the first SLEEP. ADC cycles are multiplied by the CLKPR divider
+ * (real time, simavr runs at F_CPU regardless). OCR0A/OCR0B duty of connected
+ * compare outputs is integrated over time for the LED part of the power
+ * budget. Edges of the OC0A/OC0B pins (PB0/PB1) in the last quarter of the
+ * run give the measured PWM period and duty, final timer registers the
+ * expected ones (needs a simavr that drives compare output pins).
+ * Used by tools/profile.py, which builds per-mode ELFs and compiles this file.
+ *
+ * Build:
+ * > gcc -O2 -I/usr/include/simavr -o profile profile.c -lsimavr -lelf
+ * Usage:
+ * > profile quasar.elf [seconds] [avr-nm]
+ * Output lines: <cycles> <function>, SLEEP for cycles spent sleeping,
+ * <cycles> @<state>/<divider>, <cycles> @ADC, <cycles> @BOOT, <cycles * OCR> @OC0A|@OC0B,
+ * <value> @<pin>RISES|SPAN|HIGH|LEVEL of PB0/PB1, <value> @<register> final timer and clock registers,
+ * <Hz> @HZ, TOTAL last
+ */
+
+#include "harness.h"
+#include "sim_irq.h"
+#include "avr_ioport.h"
+
+#define MAX_SYMBOLS 128
+
+typedef struct {
+	uint32_t addr;
+	uint32_t size;
+	char name[64];
+	avr_cycle_count_t cycles;
+} symbol_t;
+
+static symbol_t symbols[MAX_SYMBOLS];
+static int symbolsCount = 0;
+
+/* Awake and sleep modes by MCUCR SM1:0 + 1 */
+static const char * const stateNames[] = { "ACTIVE", "IDLE", "ADCNR", "POWERDOWN", "STANDBY" };
+static avr_cycle_count_t stateCycles[5][9];	// Per state and CLKPR divider exponent
+
+/* Compare output pin edges */
+typedef struct {
+	avr_cycle_count_t rise;	// Last rising edge
+	avr_cycle_count_t span;	// First to last rising edge
+	avr_cycle_count_t high;	// High time of complete periods within span
+	avr_cycle_count_t pending;	// High time of period after last rising edge
+	unsigned long rises;
+	int level;
+} pin_t;
+
+static pin_t pins[2];	// PB0 (OC0A), PB1 (OC0B)
+static avr_t * mcu;
+static avr_cycle_count_t window;	// Edges are measured from this cycle on
+
+
+/* Read function symbols with sizes from ELF */
+static void readSymbols(const char * elf, const char * nm) {
+	char command[512], line[256], type;
+	unsigned addr, size;
+	snprintf(command, sizeof(command), "%s -n -S \"%s\"", nm, elf);
+	FILE * pipe = popen(command, "r");
+	if (!pipe) {
+		perror(nm);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), pipe) && symbolsCount < MAX_SYMBOLS - 1) {
+		symbol_t * s = &symbols[symbolsCount];
+		if (sscanf(line, "%x %x %c %63s", &addr, &size, &type, s->name) != 4) continue;
+		if (type != 't' && type != 'T' && type != 'W') continue;
+		s->addr = addr;
+		s->size = size;
+		symbolsCount++;
+	}
+	pclose(pipe);
+	strcpy(symbols[symbolsCount].name, "?");	// Code outside of sized symbols (vectors, startup)
+}
+
+
+/* Find symbol containing byte address */
+static symbol_t * findSymbol(uint32_t pc) {
+	for (int i = 0; i < symbolsCount; i++) {
+		if (pc >= symbols[i].addr && pc < symbols[i].addr + symbols[i].size) return &symbols[i];
+	}
+	return &symbols[symbolsCount];
+}
+
+
+/* Pin change notification of IOPORT B */
+static void onPin(avr_irq_t * irq, uint32_t value, void * param) {
+	pin_t * p = param;
+	(void)irq;
+	if (!value == !p->level) return;
+	p->level = value != 0;
+	if (mcu->cycle < window) return;
+	if (value) {
+		if (p->rises) {
+			p->span += mcu->cycle - p->rise;
+			p->high += p->pending;
+		}
+		p->pending = 0;
+		p->rise = mcu->cycle;
+		p->rises++;
+	} else if (p->rises) {
+		p->pending = mcu->cycle - p->rise;
+	}
+}
+
+
+int main(int argc, char * argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s quasar.elf [seconds] [avr-nm]\n", argv[0]);
+		return 1;
+	}
+	double seconds = argc > 2 ? atof(argv[2]) : 10;
+	readSymbols(argv[1], argc > 3 ? argv[3] : "avr-nm");
+
+	const registers_t * regs;
+	avr_t * avr = loadFirmware(argv[1], &regs);
+
+	avr_cycle_count_t end = (avr_cycle_count_t)(seconds * avr->frequency);
+	mcu = avr;
+	window = end - end / 4;
+	for (int i = 0; i < 2; i++) avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), i), onPin, &pins[i]);
+	avr_cycle_count_t sleep = 0, adc = 0, boot = 0;
+	unsigned long long dutyA = 0, dutyB = 0;
+	while (avr->cycle < end) {
+		avr_cycle_count_t start = avr->cycle;
+		int sleeping = avr->state == cpu_Sleeping;
+		int power = sleeping ? 1 + ((avr->data[regs->mcucr] >> 3) & 3) : 0;
+		int divider = avr->data[regs->clkpr] & 0x0f;
+		int adcOn = (avr->data[regs->adcsra] & 0x80) && !(avr->data[regs->prr] & 1);
+		uint8_t ocrA = avr->data[regs->tccr0a] & 0x80 ? avr->data[regs->ocr0a] : 0;	// COM0A1/COM0B1 connect output
+		uint8_t ocrB = avr->data[regs->tccr0a] & 0x20 ? avr->data[regs->ocr0b] : 0;
+		symbol_t * s = findSymbol(avr->pc);
+		int state = avr_run(avr);
+		if (sleeping) sleep += avr->cycle - start;
+		else s->cycles += avr->cycle - start;
+		if (sleeping && !boot) boot = start;
+		stateCycles[power][divider > 8 ? 8 : divider] += avr->cycle - start;
+		if (adcOn) adc += (avr->cycle - start) << (divider > 8 ? 8 : divider);	// ADC clock is divided too, CLKPR is not emulated
+		dutyA += (unsigned long long)ocrA * (avr->cycle - start);
+		dutyB += (unsigned long long)ocrB * (avr->cycle - start);
+		if (state == cpu_Done || state == cpu_Crashed) break;
+	}
+
+	for (int i = 0; i <= symbolsCount; i++) {
+		if (symbols[i].cycles) printf("%llu %s\n", (unsigned long long)symbols[i].cycles, symbols[i].name);
+	}
+	printf("%llu SLEEP\n", (unsigned long long)sleep);
+	for (int i = 0; i < 5; i++) {
+		for (int d = 0; d < 9; d++) {
+			if (stateCycles[i][d]) printf("%llu @%s/%d\n", (unsigned long long)stateCycles[i][d], stateNames[i], 1 << d);
+		}
+	}
+	printf("%llu @ADC\n", (unsigned long long)adc);
+	printf("%llu @BOOT\n", (unsigned long long)(boot ? boot : avr->cycle));
+	printf("%llu @OC0A\n", dutyA);
+	printf("%llu @OC0B\n", dutyB);
+	for (int i = 0; i < 2; i++) {
+		printf("%lu @PB%dRISES\n", pins[i].rises, i);
+		printf("%llu @PB%dSPAN\n", (unsigned long long)pins[i].span, i);
+		printf("%llu @PB%dHIGH\n", (unsigned long long)pins[i].high, i);
+		printf("%d @PB%dLEVEL\n", pins[i].level, i);
+	}
+	printf("%u @TCCR0A\n", avr->data[regs->tccr0a]);
+	printf("%u @TCCR0B\n", avr->data[regs->tccr0b]);
+	printf("%u @OCR0A\n", avr->data[regs->ocr0a]);
+	printf("%u @OCR0B\n", avr->data[regs->ocr0b]);
+	printf("%u @CLKPR\n", avr->data[regs->clkpr]);
+	printf("%u @HZ\n", (unsigned)avr->frequency);
+	printf("%llu TOTAL\n", (unsigned long long)avr->cycle);
+	return 0;
+}
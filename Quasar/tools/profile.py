@@ -0,0 +1,230 @@
+#!/usr/bin/env python3
+"""
+Active duty cycle profiler of Quasar firmware
+
+Builds a SIMAVR ELF per mode of a group (or per --scenario of
+tools/simulate.py, e.g. locked), runs each in simavr with tools/profile.c
+and reports the fraction of cycles the MCU is awake, split per function:
+WDT ISR (__vector_8), getBatteryVoltage with its ADC spin-waits, eepSave
+with its EEPROM write waits, etc.
+The awake fraction drives the parasitic MCU current on low modes.
+Boot time is measured until the first SLEEP and includes waits for EEPROM
+writes (simavr takes 3.4ms per write), for the locked scenario it is the
+time a locked light stays awake after a click before it powers down.
+
+simavr does not emulate CLKPR and keeps running code at F_CPU, so awake
+cycles of LOW_CLOCK levels are as many as on a real MCU but take 1/divider of
+the time there. The current model multiplies awake (and ADC enabled) cycles
+by the CLKPR divider in effect to get real time, takes the extra time from
+sleep (WDT wake-ups keep real time), and applies per-MHz currents at the
+divided clock. Awake shares per function are printed in simulated cycles.
+
+MCU current model: time shares of awake, idle and power-down per clock,
+ADC enabled (any state) and BOD (set by the fuses in quasar.c) are weighted
+with typical ATtiny13A currents at 3V, override them with --current
+NAME=VALUE (mA, per MHz for clocked states). --compare NAME builds every
+mode with the setting on and off, e.g. POWER_GATING or LOW_CLOCK, and
+reports the difference in average MCU current.
+
+Power budget: LED current is the time-weighted OCR0A/OCR0B duty times the
+channel current at full duty (--led-a/--led-b mA, board defaults like
+tools/runtime.py), runtime is --capacity divided by MCU plus LED current.
+On moon levels MCU current is a noticeable part of the budget, e.g.
+  profile.py --compare LOW_CLOCK --modes 0
+shows the runtime gained by LOW_CLOCK (cell voltage sag is ignored, use
+tools/runtime.py for full discharges).
+
+PWM check: period and duty of OC0A/OC0B pins measured in the last quarter
+of each run are compared with the final timer settings (phase-correct
+TOP 510, fast PWM TOP 256, timer prescaler and CLKPR divider), so FAST_PWM
+and LOW_CLOCK switching is verified per mode. A mismatch fails the run.
+
+Usage:
+  profile.py [--board nanjg] [--group 0] [--modes 0,1,2,3] [--seconds 10] [--scenario NAME] [--define NAME=VALUE] [--compare NAME]
+             [--current NAME=VALUE] [--led-a mA] [--led-b mA] [--capacity 3000] [--simavr-include /usr/include/simavr]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+
+import build
+import runtime
+import simulate
+
+# Typical ATtiny13A supply currents at 3V, mA (datasheet typical characteristics)
+CURRENT = {
+    'active': 0.25,     # per MHz of CPU clock, awake
+    'idle': 0.06,       # per MHz of CPU clock, idle sleep (timer0 keeps running PWM)
+    'adcnr': 0.05,      # per MHz of CPU clock, ADC noise reduction sleep
+    'powerdown': 0.004, # power-down sleep with WDT running
+    'adc': 0.12,        # ADC enabled and powered, added in any state
+    'bod': 0.02,        # brown-out detector, always on with BODLEVEL fuses set
+}
+# Timer0 clock select CS02:0 -> prescaler, 0 when stopped or external
+PRESCALERS = (0, 1, 8, 64, 256, 1024, 0, 0)
+# LED current of OC0A and OC0B channels at full duty, mA: Nanjg 8x AMC7135 on OC0B, A17DD-L AMC7135 on OC0A and FET on OC0B
+LOADS = {
+    'nanjg': (0, 2800),
+    'a17dd-l': (350, 4000),
+}
+
+
+def profile(profiler, elf, seconds, nm):
+    """Return {function: cycles} including SLEEP and TOTAL"""
+    output = subprocess.run([profiler, os.path.basename(elf), str(seconds), nm], cwd=os.path.dirname(elf),
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True, check=True).stdout
+    return {name: int(cycles) for cycles, name in (line.split(None, 1) for line in output.splitlines())}
+
+
+def mcu_current(cycles, model):
+    """Average MCU current in mA per part of the model from power state cycles, awake cycles scaled to real time"""
+    mhz = cycles['@HZ'] / 1e6
+    states = []
+    for name, count in cycles.items():
+        if '/' in name:
+            state, divider = name[1:].lower().split('/')
+            states.append(('powerdown' if state == 'standby' else state, int(divider), count))
+    extra = sum((divider - 1) * count for state, divider, count in states if state == 'active')
+    asleep = sum(count for state, divider, count in states if state != 'active')
+    squeeze = max(0.0, 1 - float(extra) / asleep) if asleep else 1.0  # Sleep left after the longer awake time
+    times = [(state, divider, count * (divider if state == 'active' else squeeze)) for state, divider, count in states]
+    total = sum(time for state, divider, time in times)
+    parts = dict.fromkeys(('active', 'idle', 'adcnr', 'powerdown'), 0.0)
+    for state, divider, time in times:
+        scale = 1 if state == 'powerdown' else mhz / divider
+        parts[state] += model[state] * scale * time / total
+    parts['adc'] = model['adc'] * min(1.0, cycles.get('@ADC', 0) / total)
+    parts['bod'] = model['bod']
+    return parts
+
+
+def measure(profiler, label, settings, args, nm):
+    """Build and profile one variant, return cycles or error string"""
+    entry = build.build_config(label, settings, args.out, args.cc, ['-I' + os.path.join(args.simavr_include, 'avr')])
+    if 'error' in entry:
+        return entry['error']
+    try:
+        return profile(profiler, os.path.join(args.out, label + '.elf'), args.seconds, nm)
+    except (subprocess.CalledProcessError, OSError) as error:
+        return str(getattr(error, 'stderr', None) or error)
+
+
+def check_pwm(cycles):
+    """Print measured and expected waveform of connected compare outputs, return True when they agree"""
+    tccr0a, prescaler, divider = cycles['@TCCR0A'], PRESCALERS[cycles['@TCCR0B'] & 7], 1 << (cycles['@CLKPR'] & 0x0f)
+    fast = tccr0a & 3 == 3
+    agree = True
+    for pin, channel, com in ((0, 'OC0A', 0x80), (1, 'OC0B', 0x20)):
+        if not tccr0a & com or not prescaler:
+            continue
+        ocr = cycles['@OCR' + channel[2:]]
+        period = (256 if fast else 510) * prescaler  # simavr cycles, CLKPR is not emulated
+        duty = (ocr + 1) / 256.0 if fast else ocr / 255.0
+        if fast and ocr == 255 or not fast and ocr in (0, 255):
+            duty, period = float(ocr == 255), None  # Constant output level
+        rises = cycles['@PB%dRISES' % pin]
+        if rises < 2:
+            measured_duty, measured_period = float(cycles['@PB%dLEVEL' % pin]), None
+        else:
+            measured_duty = cycles['@PB%dHIGH' % pin] / float(cycles['@PB%dSPAN' % pin])
+            measured_period = cycles['@PB%dSPAN' % pin] / float(rises - 1)
+        good = abs(measured_duty - duty) < 0.01 and (period is None) == (measured_period is None) and (
+            period is None or abs(measured_period - period) < period / 100)
+        agree = agree and good
+        frequency = lambda value: 'constant' if value is None else '%.3fkHz' % (cycles['@HZ'] / divider / value / 1e3)
+        print('  %s %-13s %8s %5.1f%%  expected %8s %5.1f%%  %s' % (
+            channel, 'fast PWM' if fast else 'phase-correct', frequency(measured_period), 100 * measured_duty,
+            frequency(period), 100 * duty, 'OK' if good else 'MISMATCH'))
+    return agree
+
+
+def report(label, cycles, model, loads):
+    """Print awake share per function, MCU and LED current, PWM check, return (MCU mA, LED mA, PWM agrees)"""
+    total, sleep = cycles['TOTAL'], cycles.get('SLEEP', 0)
+    parts = mcu_current(cycles, model)
+    print('%-20s active %6.3f%%  (%d of %d cycles), boot %.1fms' % (
+        label, 100.0 * (total - sleep) / total, total - sleep, total, 1e3 * cycles['@BOOT'] / cycles['@HZ']))
+    for name, count in sorted(cycles.items(), key=lambda item: -item[1]):
+        if name not in ('TOTAL', 'SLEEP') and not name.startswith('@'):
+            print('  %-24s %6.3f%%  %d' % (name, 100.0 * count / total, count))
+    print('  MCU %.1fuA: %s' % (1e3 * sum(parts.values()),
+                               ', '.join('%s %.1f' % (name, 1e3 * value) for name, value in parts.items())))
+    led = sum(load * cycles['@' + channel] / 255.0 / total for load, channel in zip(loads, ('OC0A', 'OC0B')))
+    print('  LED %.2fmA' % led)
+    return sum(parts.values()), led, check_pwm(cycles)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--board', default='nanjg', choices=sorted(build.BOARDS))
+    parser.add_argument('--group', type=int, default=0)
+    parser.add_argument('--modes', default='0,1,2,3', help='comma separated mode numbers')
+    parser.add_argument('--scenario', action='append', help='tools/simulate.py scenario instead of --modes, repeatable')
+    parser.add_argument('--seconds', type=float, default=10, help='simulated time per mode')
+    parser.add_argument('--define', action='append', default=[], help='firmware setting NAME=VALUE (or on/off), repeatable')
+    parser.add_argument('--compare', metavar='NAME', help='profile every mode with setting NAME on and off')
+    parser.add_argument('--current', action='append', default=[], help='current model NAME=VALUE, mA: %s' % ', '.join(
+        '%s=%g' % item for item in CURRENT.items()))
+    parser.add_argument('--led-a', type=float, help='OC0A channel current at full duty, mA, default by board')
+    parser.add_argument('--led-b', type=float, help='OC0B channel current at full duty, mA, default by board')
+    parser.add_argument('--capacity', type=float, default=3000, help='cell capacity for runtime, mAh')
+    parser.add_argument('--out', default=os.path.join(build.ROOT, 'build', 'profile'), help='output directory')
+    parser.add_argument('--cc', default='avr-gcc')
+    parser.add_argument('--simavr-include', default='/usr/include/simavr', help='directory containing sim_avr.h')
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    try:
+        profiler = build.compile_harness('profile', args.out, args.simavr_include)
+    except (RuntimeError, OSError) as error:
+        sys.exit('Unable to build profiler\n%s' % error)
+    model = dict(CURRENT)
+    for item in args.current:
+        name, value = item.split('=', 1)
+        if name not in model:
+            sys.exit('Unknown current %s' % name)
+        model[name] = float(value)
+    loads = (LOADS[args.board][0] if args.led_a is None else args.led_a,
+             LOADS[args.board][1] if args.led_b is None else args.led_b)
+    defines = dict(define.split('=', 1) for define in args.define)
+    variants = [('-on', {args.compare: 'on'}), ('-off', {args.compare: 'off'})] if args.compare else [('', {})]
+    scenarios = simulate.scenarios(args.board, args.group, 0)
+    nm = build.tool(args.cc, 'nm')
+    unknown = [name for name in args.scenario or [] if name not in scenarios]
+    if unknown:
+        sys.exit('Unknown scenario %s, available: %s' % (', '.join(unknown), ', '.join(scenarios)))
+
+    results, failed = [], 0
+    for name in args.scenario or ['mode' + m for m in args.modes.split(',')]:
+        budgets = []
+        for suffix, setting in variants:
+            label = '%s-%s%s' % (args.board, name, suffix)
+            cycles = measure(profiler, label, dict(scenarios[name], **dict(defines, **setting)), args, nm)
+            if isinstance(cycles, str):
+                print('%-20s FAILED\n%s' % (label, cycles.strip()))
+                failed += 1
+                break
+            budgets.append(report(label, cycles, model, loads))
+            failed += not budgets[-1][2]
+        else:
+            results.append((name, budgets))
+
+    hours = lambda mcu, led: runtime.hms(3600 * args.capacity / (mcu + led))
+    if args.compare:
+        print('\n%-12s %12s %12s %8s %10s %10s %10s %7s' % ('', 'MCU on', 'MCU off', 'change', 'LED', 'runtime on',
+                                                         'off', 'gain'))
+        for name, ((on, led, _), (off, led_off, _)) in results:
+            print('%-12s %10.1fuA %10.1fuA %7.1f%% %8.2fmA %10s %10s %6.1f%%' % (
+                name, 1e3 * on, 1e3 * off, 100.0 * (on - off) / off, led, hours(on, led), hours(off, led_off),
+                100.0 * ((off + led_off) / (on + led) - 1)))
+    else:
+        print('\n%-12s %10s %10s %10s' % ('', 'MCU', 'LED', 'runtime'))
+        for name, ((mcu, led, _),) in results:
+            print('%-12s %8.1fuA %8.2fmA %10s' % (name, 1e3 * mcu, led, hours(mcu, led)))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
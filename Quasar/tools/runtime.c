@@ -0,0 +1,156 @@
+/*
+ * Firmware-in-the-loop runtime benchmark for Quasar in simavr
+ *
+ * Runs a SIMAVR ELF built with SIM_ADC against a Li-ion cell model (OCV curve
+ * and internal resistance) and an LED load driven by FET or AMC7135 channels.
+ * Loaded cell voltage is fed to ADC1 through the divider, so BATTMON
+ * step-downs and TURBO_TIMEOUT act as on hardware. Heat not emitted as light
+ * warms a thermal RC model of the host, fed to the ATtiny25/45/85 temperature
+ * sensor for THERMAL regulation. Used by tools/runtime.py.
+ *
+ * Build:
+ * > gcc -O2 -I/usr/include/simavr -o runtime runtime.c -lsimavr -lelf
+ * Usage:
+ * > runtime quasar.elf [name=value ...]
+ * Output: 'seconds,soc,volts,amps,celsius' every interval, then 'RUNTIME seconds' or 'NOOUTPUT'
+ */
+
+#include "harness.h"
+#include "sim_irq.h"
+#include "avr_adc.h"
+
+typedef struct {
+	const char * name;
+	double value;
+	const char * help;
+} param_t;
+
+static param_t params[] = {
+	{ "capacity", 3000, "cell capacity, mAh" },
+	{ "rcell", 0.05, "cell internal resistance, Ohm" },
+	{ "cutoff", 2.8, "loaded cell voltage of protection cut-off, V" },
+	{ "vf", 2.75, "LED forward voltage at zero current, V" },
+	{ "rled", 0.15, "LED dynamic resistance, Ohm" },
+	{ "rpath", 0.05, "springs, wires and FET resistance, Ohm" },
+	{ "dropout", 0.12, "AMC7135 dropout, V" },
+	{ "loada", 0, "OC0A load: number of AMC7135, -1 for FET" },
+	{ "loadb", 8, "OC0B load: number of AMC7135, -1 for FET" },
+	{ "r1", 19100, "upper divider resistor, Ohm" },
+	{ "r2", 4700, "lower divider resistor, Ohm" },
+	{ "drop", 0.25, "diode drop before divider, V" },
+	{ "efficiency", 0.3, "fraction of cell power emitted as light" },
+	{ "rth", 8, "host to ambient thermal resistance, K/W" },
+	{ "cth", 15, "host heat capacity, J/K" },
+	{ "ambient", 25, "ambient temperature, C" },
+	{ "interval", 10, "output interval, s" },
+	{ "accelerate", 1, "charge drawn per simulated second, s (firmware timers are not scaled)" },
+};
+#define PARAMS_COUNT (sizeof(params) / sizeof(params[0]))
+#define P(index) params[index].value
+enum { CAPACITY, RCELL, CUTOFF, VF, RLED, RPATH, DROPOUT, LOADA, LOADB, R1, R2, DROP, EFFICIENCY, RTH, CTH, AMBIENT, INTERVAL, ACCELERATE };
+
+/* Open circuit voltage at 0%, 10% ... 100% state of charge */
+static const double ocvTable[] = { 3.00, 3.45, 3.55, 3.62, 3.68, 3.74, 3.81, 3.89, 3.97, 4.06, 4.20 };
+
+
+static double getOCV(double soc) {
+	if (soc <= 0) return ocvTable[0];
+	if (soc >= 1) return ocvTable[10];
+	int i = (int)(soc * 10);
+	double f = soc * 10 - i;
+	return ocvTable[i] + (ocvTable[i + 1] - ocvTable[i]) * f;
+}
+
+
+/* LED current of a fully on channel */
+static double getChannelCurrent(double load, double ocv) {
+	if (load < 0) {
+		double current = (ocv - P(VF)) / (P(RCELL) + P(RLED) + P(RPATH));
+		return current > 0 ? current : 0;
+	}
+	double regulated = load * 0.35;
+	double current = (ocv - P(DROPOUT) - P(VF)) / (P(RCELL) + P(RLED));	// Out of regulation
+	if (current < 0) return 0;
+	return current < regulated ? current : regulated;
+}
+
+
+/* Duty of compare output channel, 0 if disconnected */
+static double getDuty(avr_t * avr, const registers_t * regs, uint8_t ocr, uint8_t com) {
+	if (!(avr->data[regs->tccr0a] & com)) return 0;
+	return avr->data[ocr] / 255.0;
+}
+
+
+static void parseParams(int argc, char * argv[]) {
+	for (int i = 2; i < argc; i++) {
+		char * eq = strchr(argv[i], '=');
+		unsigned p;
+		for (p = 0; eq && p < PARAMS_COUNT; p++) {
+			if (strlen(params[p].name) == (size_t)(eq - argv[i]) && !strncmp(params[p].name, argv[i], eq - argv[i])) break;
+		}
+		if (!eq || p == PARAMS_COUNT) {
+			fprintf(stderr, "Unknown parameter %s, available:\n", argv[i]);
+			for (p = 0; p < PARAMS_COUNT; p++) fprintf(stderr, "  %s=%g  %s\n", params[p].name, params[p].value, params[p].help);
+			exit(1);
+		}
+		params[p].value = atof(eq + 1);
+	}
+}
+
+
+int main(int argc, char * argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s quasar.elf [name=value ...]\n", argv[0]);
+		return 1;
+	}
+	parseParams(argc, argv);
+
+	const registers_t * regs;
+	avr_t * avr = loadFirmware(argv[1], &regs);
+	avr_irq_t * adc = avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC1);
+	avr_irq_t * sensor = avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_TEMP);
+
+	const double step = 0.001;	// Model update period, s
+	avr_cycle_count_t stepCycles = (avr_cycle_count_t)(step * avr->frequency);
+	double charge = P(CAPACITY) * 3.6;	// Coulombs
+	double seconds = 0, nextOutput = 0, lastLit = 0;
+	double volts = getOCV(1);
+	double celsius = P(AMBIENT);
+
+	while (1) {
+		double ocv = getOCV(charge / (P(CAPACITY) * 3.6));
+		double amps = getDuty(avr, regs, regs->ocr0a, 0x80) * getChannelCurrent(P(LOADA), ocv)
+					+ getDuty(avr, regs, regs->ocr0b, 0x20) * getChannelCurrent(P(LOADB), ocv);
+		volts = ocv - amps * P(RCELL);
+		double divided = (volts - P(DROP)) * P(R2) / (P(R1) + P(R2));
+		avr_raise_irq(adc, divided > 0 ? (uint32_t)(divided * 1000) : 0);	// Millivolts
+		double counts = 300 + (celsius - 25) * 14 / 13;	// Typical sensor reading, see THERMAL_ADC
+		avr_raise_irq(sensor, (uint32_t)(counts * 1100 / 1024));	// Millivolts against 1.1V reference
+
+		avr_cycle_count_t end = avr->cycle + stepCycles;
+		while (avr->cycle < end) {
+			int state = avr_run(avr);
+			if (state == cpu_Done || state == cpu_Crashed) {
+				fprintf(stderr, "Firmware stopped at %.1fs\n", seconds);
+				return 1;
+			}
+		}
+		charge -= amps * step * P(ACCELERATE);
+		celsius += (volts * amps * (1 - P(EFFICIENCY)) - (celsius - P(AMBIENT)) / P(RTH)) * step / P(CTH);
+		seconds += step;
+
+		if (amps > 0) lastLit = seconds;
+		else if (seconds - lastLit > 60 && lastLit == 0) {
+			printf("NOOUTPUT\n");
+			return 0;
+		}
+		if (seconds >= nextOutput) {
+			printf("%.0f,%.4f,%.3f,%.3f,%.1f\n", seconds * P(ACCELERATE), charge / (P(CAPACITY) * 3.6), volts, amps, celsius);
+			nextOutput += P(INTERVAL) / P(ACCELERATE);
+		}
+		if (charge <= 0 || volts < P(CUTOFF)) break;
+	}
+	printf("RUNTIME %.0f\n", seconds * P(ACCELERATE));
+	return 0;
+}
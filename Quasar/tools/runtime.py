@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""
+Firmware-in-the-loop runtime benchmark of Quasar
+
+Builds a SIMAVR ELF with SIM_ADC for every groups[][] entry and runs each
+with tools/runtime.c until the cell is empty or protection cuts off, so
+BATTMON step-downs and TURBO_TIMEOUT are included. Output curve of each entry
+is saved as <out>/<board>-g<group>m<mode>.csv (seconds, state of charge,
+loaded cell voltage, LED current, host temperature), runtimes are printed
+as a table.
+
+Thermal regulation of ATtiny25/45/85 builds is validated against the host
+RC model of the harness, e.g.:
+  runtime.py --mcu attiny85 --define THERMAL=55 rth=8 cth=15
+
+Model parameters are passed to the harness as name=value, run
+'build/runtime/runtime x.elf help=' to list them. Board defaults set the
+channel loads: Nanjg 8x AMC7135 on OC0B, A17DD-L FET on OC0B and one
+AMC7135 on OC0A.
+
+Full discharges take long in simavr, --accelerate K drains K seconds of
+charge per simulated second (firmware timers are not scaled, so turbo and
+LVP reactions appear K times longer).
+
+Usage:
+  runtime.py [--board nanjg] [--mcu attiny13a] [--define NAME=VALUE] [--accelerate 1] [--jobs N] [--simavr-include /usr/include/simavr] [name=value ...]
+"""
+
+import argparse
+import concurrent.futures
+import os
+import subprocess
+import sys
+
+import build
+
+LOADS = {
+    'nanjg': ['loada=0', 'loadb=8'],
+    'a17dd-l': ['loada=1', 'loadb=-1'],
+}
+
+
+def config(args, group, mode):
+    settings = dict(define.split('=', 1) for define in args.define)
+    settings.update({'board': args.board, 'mcu': args.mcu, 'SIMAVR': 'on', 'SIM_ADC': 'on', 'SIM_GROUP': str(group),
+                     'SIM_MODE': str(mode), 'SIM_CLICKS': '0'})
+    return settings
+
+
+def run(harness, elf, params):
+    """Run one entry, return (runtime or None, [(seconds, soc, volts, amps, celsius)])"""
+    output = subprocess.run([harness, os.path.basename(elf)] + params, cwd=os.path.dirname(elf),
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True, check=True).stdout
+    curve, runtime = [], None
+    for line in output.splitlines():
+        if line.startswith('RUNTIME'):
+            runtime = float(line.split()[1])
+        elif ',' in line:
+            curve.append(tuple(float(v) for v in line.split(',')))
+    return runtime, curve
+
+
+def bench(harness, board, group, mode, args):
+    label = '%s-g%dm%d' % (board, group, mode)
+    entry = build.build_config(label, config(args, group, mode), args.out, args.cc,
+                               ['-I' + os.path.join(args.simavr_include, 'avr')])
+    if 'error' in entry:
+        return label, entry['error']
+    params = LOADS[board] + ['accelerate=%g' % args.accelerate] + args.params
+    try:
+        runtime, curve = run(harness, os.path.join(args.out, label + '.elf'), params)
+    except subprocess.CalledProcessError as error:
+        return label, error.stderr
+    with open(os.path.join(args.out, label + '.csv'), 'w') as file:
+        file.write('seconds,soc,volts,amps,celsius\n')
+        file.writelines('%g,%g,%g,%g,%g\n' % point for point in curve)
+    return label, (runtime, curve)
+
+
+def hms(seconds):
+    return '%d:%02d:%02d' % (seconds // 3600, seconds // 60 % 60, seconds % 60)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--board', default='nanjg', choices=sorted(build.BOARDS))
+    parser.add_argument('--mcu', default=build.MCU, choices=sorted(build.MCUS))
+    parser.add_argument('--define', action='append', default=[], help='firmware setting NAME=VALUE (or on/off), repeatable')
+    parser.add_argument('--accelerate', type=float, default=1, help='seconds of charge drawn per simulated second')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count(), help='parallel simulations')
+    parser.add_argument('--out', default=os.path.join(build.ROOT, 'build', 'runtime'), help='output directory')
+    parser.add_argument('--cc', default='avr-gcc')
+    parser.add_argument('--simavr-include', default='/usr/include/simavr', help='directory containing sim_avr.h')
+    parser.add_argument('params', nargs='*', help='model parameters for tools/runtime.c, name=value')
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    try:
+        harness = build.compile_harness('runtime', args.out, args.simavr_include)
+    except (RuntimeError, OSError) as error:
+        sys.exit('Unable to build harness\n%s' % error)
+
+    # Table dimensions of the current source
+    probe = build.build_config('%s-probe' % args.board, config(args, 0, 0), args.out, args.cc,
+                               ['-I' + os.path.join(args.simavr_include, 'avr')])
+    if 'error' in probe:
+        sys.exit(probe['error'])
+    groups, modes = int(probe['features']['GROUPS_COUNT']), int(probe['features']['MODES_COUNT'])
+
+    entries = [(g, m) for g in range(groups) for m in range(modes)]
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        results = pool.map(lambda entry: bench(harness, args.board, entry[0], entry[1], args), entries)
+        print('%-16s %10s %8s %8s %8s %6s' % ('entry', 'runtime', 'start A', '50% at', 'end A', 'max C'))
+        for label, result in results:
+            if isinstance(result, str):
+                print('%-16s FAILED\n%s' % (label, result.strip()))
+                continue
+            runtime, curve = result
+            if runtime is None:
+                print('%-16s %10s' % (label, 'no output'))
+                continue
+            start = curve[min(1, len(curve) - 1)][3] if curve else 0
+            half = next((point[0] for point in curve if point[3] < start / 2), runtime)
+            print('%-16s %10s %8.2f %8s %8.2f %6.1f' % (label, hms(runtime), start, hms(half), curve[-1][3] if curve else 0,
+                                                      max(point[4] for point in curve) if curve else 0))
+
+
+if __name__ == '__main__':
+    main()
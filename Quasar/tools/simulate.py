@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+"""
+simavr waveform capture of Quasar firmware
+
+Builds an ELF of a board with SIMAVR defined (see quasar.c) for each scenario,
+runs it in simavr and saves the VCD trace as <out>/<board>-<scenario>.vcd,
+open it with GTKWave. Traced are the PWM output pins, OCR0A/OCR0B, CLKPR,
+EEPROM writes (EEPE, EEAR, EEDR) and WDT interrupts; each WDT interrupt is
+a wake-up from sleep, the MCU sleeps between them once main() is idle.
+
+Scenarios set the mode ring record the firmware finds at power-on and the
+ADC readings simavr cannot provide:
+  mode0...mode7   boot into mode of --group, last on-time was long
+  groupchange     boot into GROUP_CHANGE_MODE, shows group change blink
+  battcheck       BATTCHECK fast clicks done, shows battery check blinks
+  lvp             boot into --lvp-mode with battery below BATTMON, shows LVP step-down
+  locked          LOCKOUT enabled and locked, short click: boot until power-down
+                  (profile.py --scenario locked reports its boot time)
+  rstrobe         RSTROBE enabled and alone in group 0, shows random strobe (tools/strobe.py
+                  checks its interval distribution)
+
+Usage:
+  simulate.py [--board nanjg] [--group 0] [--seconds 5] [--include /usr/include/simavr] [scenario ...]
+"""
+
+import argparse
+import os
+import shutil
+import signal
+import subprocess
+import sys
+import time
+
+import build
+
+
+def scenarios(board, group, lvp_mode):
+    """Config settings of each scenario"""
+    # A17DD-L detects short clicks with OTC capacitor, Nanjg with short-on marker in EEPROM
+    short = {'SIM_CAP': '255'} if board == 'a17dd-l' else {}
+    marker = '' if board == 'a17dd-l' else '0x80 | '
+    result = {}
+    for mode in range(8):
+        result['mode%d' % mode] = {'SIM_MODE': str(mode), 'SIM_CLICKS': '0'}
+    result['groupchange'] = {'SIM_MODE': 'GROUP_CHANGE_MODE', 'SIM_CLICKS': '0'}
+    result['battcheck'] = dict(short, SIM_MODE='0', SIM_CLICKS='(%s(BATTCHECK - 1))' % marker)
+    result['locked'] = dict(short, LOCKOUT='on', SIM_MODE='0', SIM_CLICKS='(%sLOCKED)' % marker)
+    result['lvp'] = {'SIM_MODE': str(lvp_mode), 'SIM_CLICKS': '0', 'SIM_BATTERY': '(BATTMON - 10)'}
+    for settings in result.values():
+        settings.update({'board': board, 'SIMAVR': 'on', 'SIM_GROUP': str(group)})
+    result['rstrobe'] = dict(result['mode0'], RSTROBE='on', groups='{{ RSTROBE }}', SIM_GROUP='0')
+    return result
+
+
+def simulate(elf, vcd, seconds, simavr):
+    """Run ELF in simavr, it writes quasar.vcd in working directory when interrupted"""
+    workdir = os.path.dirname(elf)
+    process = subprocess.Popen([simavr, os.path.basename(elf)], cwd=workdir,
+                               stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+    time.sleep(seconds)
+    process.send_signal(signal.SIGINT)
+    try:
+        _, errors = process.communicate(timeout=10)
+    except subprocess.TimeoutExpired:
+        process.kill()
+        _, errors = process.communicate()
+    trace = os.path.join(workdir, 'quasar.vcd')
+    if not os.path.exists(trace):
+        raise RuntimeError('simavr wrote no trace\n' + errors)
+    shutil.move(trace, vcd)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--board', default='nanjg', choices=sorted(build.BOARDS))
+    parser.add_argument('--group', type=int, default=0, help='mode group of scenarios')
+    parser.add_argument('--lvp-mode', type=int, default=3, help='mode of lvp scenario, should be a high level')
+    parser.add_argument('--seconds', type=float, default=5, help='wall time to run each scenario')
+    parser.add_argument('--out', default=os.path.join(build.ROOT, 'build', 'sim'), help='output directory')
+    parser.add_argument('--cc', default='avr-gcc')
+    parser.add_argument('--simavr', default='simavr')
+    parser.add_argument('--include', default='/usr/include/simavr', help='directory containing avr/avr_mcu_section.h')
+    parser.add_argument('scenarios', nargs='*', help='scenarios to run, default all')
+    args = parser.parse_args()
+
+    available = scenarios(args.board, args.group, args.lvp_mode)
+    names = args.scenarios or list(available)
+    unknown = [name for name in names if name not in available]
+    if unknown:
+        sys.exit('Unknown scenario %s, available: %s' % (', '.join(unknown), ', '.join(available)))
+
+    os.makedirs(args.out, exist_ok=True)
+    failed = 0
+    for name in names:
+        label = '%s-%s' % (args.board, name)
+        entry = build.build_config(label, available[name], args.out, args.cc, ['-I' + os.path.join(args.include, 'avr')])
+        vcd = os.path.join(args.out, label + '.vcd')
+        try:
+            if 'error' in entry:
+                raise RuntimeError(entry['error'])
+            simulate(os.path.join(args.out, label + '.elf'), vcd, args.seconds, args.simavr)
+        except (RuntimeError, OSError) as error:
+            failed += 1
+            print('%-24s FAILED\n%s' % (label, str(error).strip()))
+            continue
+        print('%-24s %s' % (label, os.path.relpath(vcd)))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
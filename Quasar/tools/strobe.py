@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""
+Random strobe interval coverage check of Quasar firmware
+
+Builds the rstrobe scenario of tools/simulate.py (RSTROBE enabled and alone
+in group 0) with SIMAVR, runs it for a fixed number of simulated seconds
+with the cycle-exact recorder of tools/golden.c and splits the OCR0A/OCR0B
+timeline into flashes and pauses. Their lengths in WDT ticks are tabulated
+against the RSTROBE_ON and RSTROBE_OFF bounds of the board source:
+every length within bounds must occur, none outside, and the share of
+each length should be near uniform. Pairs of impulse and following pause
+lengths show how much of the combined range the 8-bit LFSR reaches.
+
+The WDT runs at 2048 cycles of its 128kHz oscillator per tick (16ms,
+nominally 1/50s in quasar.c), simavr uses the nominal oscillator too.
+
+Usage:
+  strobe.py [--board nanjg] [--seconds 60] [--define NAME=VALUE] [--simavr-include /usr/include/simavr]
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+import build
+import simulate
+
+TICK = 2048 / 128000.0  # WDT interrupt period, s
+
+
+def bounds(board, name, defines):
+    """(min, max) of RSTROBE_ON or RSTROBE_OFF, config override or board source"""
+    value = defines.get(name)
+    if value is None:
+        match = re.search(r'^#define\s+%s\s+([^/\n]+)' % name, open(build.BOARDS[board]).read(), re.M)
+        value = match.group(1)
+    low, high = (int(part) for part in value.split(','))
+    return low, high
+
+
+def intervals(trace):
+    """Return [(on ticks, off ticks)] from recorder output, partial first and last impulse dropped"""
+    registers, edges, lit = {'OCR0A': 0, 'OCR0B': 0}, [], False
+    for line in trace.splitlines():
+        time, name, value = line.split()[:3]
+        if name not in registers:
+            continue
+        registers[name] = int(value)
+        if any(registers.values()) != lit:
+            lit = not lit
+            edges.append(int(time) / 1e6)
+    ticks = [int(round((b - a) / TICK)) for a, b in zip(edges, edges[1:])]
+    ticks = ticks[2:] if len(ticks) > 2 else []  # Boot and first impulse follow soft start and seeding
+    return list(zip(ticks[0::2], ticks[1::2]))
+
+
+def histogram(title, values, low, high):
+    """Print distribution of values, return problems"""
+    problems = []
+    print('\n%-5s %6s %7s %8s' % (title, 'count', 'share', 'expected'))
+    for value in range(min(values + [low]), max(values + [high]) + 1):
+        count = values.count(value)
+        inside = low <= value <= high
+        print('%5d %6d %6.1f%% %7.1f%%%s' % (value, count, 100.0 * count / len(values), 100.0 / (high - low + 1) * inside,
+                                             '' if inside == bool(count) else '  <-- ' + ('missing' if inside else 'out of range')))
+        if inside != bool(count):
+            problems.append('%s %d ticks %s' % (title, value, 'never occurs' if inside else 'is out of range'))
+    return problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--board', default='nanjg', choices=sorted(build.BOARDS))
+    parser.add_argument('--seconds', type=float, default=60, help='simulated time')
+    parser.add_argument('--define', action='append', default=[], help='firmware setting NAME=VALUE (or on/off), repeatable')
+    parser.add_argument('--out', default=os.path.join(build.ROOT, 'build', 'strobe'), help='output directory')
+    parser.add_argument('--cc', default='avr-gcc')
+    parser.add_argument('--simavr-include', default='/usr/include/simavr', help='directory containing sim_avr.h')
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    try:
+        recorder = build.compile_harness('golden', args.out, args.simavr_include)
+    except (RuntimeError, OSError) as error:
+        sys.exit('Unable to build recorder\n%s' % error)
+    defines = dict(define.split('=', 1) for define in args.define)
+    label = '%s-rstrobe' % args.board
+    entry = build.build_config(label, dict(simulate.scenarios(args.board, 0, 0)['rstrobe'], **defines), args.out, args.cc,
+                               ['-I' + os.path.join(args.simavr_include, 'avr')])
+    if 'error' in entry:
+        sys.exit(entry['error'])
+    try:
+        trace = subprocess.run([recorder, label + '.elf', str(args.seconds)], cwd=args.out, stdout=subprocess.PIPE,
+                               stderr=subprocess.PIPE, universal_newlines=True, check=True).stdout
+    except subprocess.CalledProcessError as error:
+        sys.exit(error.stderr)
+
+    pairs = intervals(trace)
+    if not pairs:
+        sys.exit('%s: no strobe impulses in %gs' % (label, args.seconds))
+    on, off = bounds(args.board, 'RSTROBE_ON', defines), bounds(args.board, 'RSTROBE_OFF', defines)
+    print('%s: %d impulses in %gs, RSTROBE_ON %d...%d, RSTROBE_OFF %d...%d ticks of %.0fms' % (
+        label, len(pairs), args.seconds, on[0], on[1], off[0], off[1], TICK * 1e3))
+    problems = histogram('on', [pair[0] for pair in pairs], *on) + histogram('off', [pair[1] for pair in pairs], *off)
+    combinations = (on[1] - on[0] + 1) * (off[1] - off[0] + 1)
+    print('\n%d of %d on/off combinations occur' % (len(set(pairs)), combinations))
+    for problem in problems:
+        print(problem)
+    sys.exit(1 if problems else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""
+Decode Quasar event trace (TRACE in quasar.c) from a simulator pin dump
+
+Each event is one byte sent MSB first; a bit is a high pulse of 1 unit (0)
+or 2 units (1) in a 3 unit period. Decoding uses only the ratio of high and
+low time, so CPU clock changes (LOW_CLOCK) do not matter.
+
+Input is a VCD file (e.g. from tools/simulate.py, signal TRACE) or a text
+dump with 'time level' per line.
+
+Usage:
+  trace.py [--signal TRACE] dump.vcd|dump.txt
+"""
+
+import argparse
+import re
+import sys
+
+EVENTS = {
+    0x1: 'BOOT',
+    0x2: 'MODE %d',
+    0x3: 'COMMIT slot %d',
+    0x4: 'LVP',
+    0x5: 'TURBO',
+}
+
+
+def read_vcd(path, signal):
+    """Return (time, level) changes of signal"""
+    ident = None
+    time = 0
+    changes = []
+    for line in open(path):
+        line = line.strip()
+        match = re.match(r'\$var\s+\S+\s+\d+\s+(\S+)\s+(\S+)', line)
+        if match and match.group(2) == signal:
+            ident = match.group(1)
+        elif line.startswith('#'):
+            time = int(line[1:])
+        elif ident is not None:
+            match = re.match(r'^b?([01xz]+)\s*(\S+)$', line)
+            if match and match.group(2) == ident:
+                changes.append((time, int(match.group(1)[-1] == '1')))
+    if ident is None:
+        sys.exit('Signal %s not found in %s' % (signal, path))
+    return changes
+
+
+def read_text(path):
+    """Return (time, level) changes from 'time level' lines"""
+    changes = []
+    for line in open(path):
+        fields = line.split()
+        if len(fields) >= 2 and not line.startswith('#'):
+            changes.append((float(fields[0]), int(fields[1]) & 1))
+    return changes
+
+
+def pulses(changes):
+    """Return (start, high, low) of each high pulse, low is None for the last one"""
+    edges = []
+    level = 0
+    for time, value in changes:
+        if value != level:
+            edges.append(time)
+            level = value
+    result = []
+    for i in range(0, len(edges) - 1, 2):
+        rise, fall = edges[i], edges[i + 1]
+        low = edges[i + 2] - fall if i + 2 < len(edges) else None
+        result.append((rise, fall - rise, low))
+    return result
+
+
+def decode(pulses):
+    """Yield (time, code) of each complete byte, or (time, None) for a broken one"""
+    frame = []
+    for pulse in pulses:
+        frame.append(pulse)
+        start, high, low = pulse
+        if len(frame) < 8:
+            # Gap longer than 2 units ends the frame early
+            unit = min(min(h, l) for _, h, l in frame if l is not None) if low is not None else None
+            if low is None or low > 3 * unit:
+                yield frame[0][0], None
+                frame = []
+            continue
+        unit = sum(min(h, l) for _, h, l in frame[:7]) / 7
+        code = 0
+        for _, h, l in frame:
+            code = code << 1 | (h > 1.5 * unit)
+        yield frame[0][0], code
+        frame = []
+
+
+def describe(code):
+    if code is None:
+        return 'broken frame'
+    event = EVENTS.get(code >> 4)
+    if event is None:
+        return 'unknown 0x%02x' % code
+    return event % (code & 0xf) if '%' in event else event
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--signal', default='TRACE', help='VCD signal name of trace pin')
+    parser.add_argument('dump', help='VCD or text pin dump')
+    args = parser.parse_args()
+
+    if args.dump.lower().endswith('.vcd'):
+        changes = read_vcd(args.dump, args.signal)
+    else:
+        changes = read_text(args.dump)
+    for time, code in decode(pulses(changes)):
+        print('%12s  %s' % (time, describe(code)))
+
+
+if __name__ == '__main__':
+    main()
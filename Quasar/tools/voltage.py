@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""
+ADC-to-decivolt table generator for Quasar firmware BATTCHECK_VOLTS readout
+
+The battery is sensed on ADC1 through a resistor divider (after the reverse
+polarity diode on Nanjg boards) against the 1.1V internal reference, ADC is
+left-adjusted so only 8 high bits are used. Table entry N holds the lowest
+ADC reading for (VOLTS_MIN + 1 + N) decivolts, thresholds are placed halfway
+between neighbouring decivolts so the readout is rounded to nearest.
+
+Usage:
+  voltage.py [--r1 19100] [--r2 4700] [--drop 0.25] [--min 20] [--max 45]
+"""
+
+import argparse
+import sys
+
+VREF = 1.1
+
+
+def adc(volts, args):
+    """8-bit ADC reading for given cell voltage"""
+    value = (volts - args.drop) * args.r2 / (args.r1 + args.r2) / VREF * 256
+    return min(255, max(0, int(value)))
+
+
+def table(args):
+    return [adc((dv - 0.5) / 10, args) + 1 for dv in range(args.min + 1, args.max + 1)]
+
+
+def convert(reading, thresholds, args):
+    """Model getBatteryDecivolts() lookup"""
+    decivolts = args.min
+    for threshold in thresholds:
+        if reading < threshold:
+            break
+        decivolts += 1
+    return decivolts
+
+
+def check(thresholds, args):
+    """Check conversion across the whole ADC range, return max error in volts"""
+    step = VREF * (args.r1 + args.r2) / args.r2 / 256
+    worst, previous = 0, args.min
+    for reading in range(256):
+        decivolts = convert(reading, thresholds, args)
+        if decivolts < previous:
+            sys.exit('Conversion is not monotonic at ADC %d' % reading)
+        previous = decivolts
+        volts = reading * step + args.drop
+        if args.min / 10 < volts < args.max / 10:
+            worst = max(worst, abs(volts - decivolts / 10))
+    return worst, step
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--r1', type=float, default=19100, help='upper divider resistor, Ohm')
+    parser.add_argument('--r2', type=float, default=4700, help='lower divider resistor, Ohm')
+    parser.add_argument('--drop', type=float, default=0.25, help='diode drop before divider, V')
+    parser.add_argument('--min', type=int, default=20, help='VOLTS_MIN, decivolts')
+    parser.add_argument('--max', type=int, default=45, help='highest decivolts in table')
+    args = parser.parse_args()
+
+    thresholds = table(args)
+    worst, step = check(thresholds, args)
+    print('#define VOLTS_MIN\t%d\t// Lowest voltage readout in decivolts' % args.min)
+    print('PROGMEM const byte voltageTable[] = { %s };' % ', '.join(str(t) for t in thresholds))
+    print('// %.4f V per ADC step, max readout error %.3f V' % (step, worst), file=sys.stderr)
+    if worst > 0.05 + step:
+        sys.exit('Readout error exceeds rounding bound')
+
+
+if __name__ == '__main__':
+    main()